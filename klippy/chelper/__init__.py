@@ -21,7 +21,8 @@ SOURCE_FILES = [
     'pollreactor.c', 'msgblock.c', 'trdispatch.c',
     'kin_cartesian.c', 'kin_corexy.c', 'kin_corexz.c', 'kin_delta.c',
     'kin_deltesian.c', 'kin_polar.c', 'kin_rotary_delta.c', 'kin_winch.c',
-    'kin_extruder.c', 'kin_shaper.c', 'kin_idex.c',
+    'kin_extruder.c', 'kin_shaper.c', 'kin_idex.c', 'kin_bed_mesh.c',
+    'eddy_curve.c',
 ]
 DEST_LIB = "c_helper.so"
 OTHER_FILES = [
@@ -148,6 +149,15 @@ defs_kin_extruder = """
 """
 
 defs_kin_shaper = """
+    struct shaper_freq_map *shaper_freq_map_alloc(void);
+    void shaper_freq_map_free(struct shaper_freq_map *fm);
+    int shaper_freq_map_set(struct shaper_freq_map *fm, int x_count
+        , int y_count, double freqs[], double min_x, double min_y
+        , double max_x, double max_y, double ref_freq);
+    double shaper_freq_map_calc_freq(struct shaper_freq_map *fm
+        , double x, double y);
+    int input_shaper_set_freq_map(struct stepper_kinematics *sk, char axis
+        , struct shaper_freq_map *fm);
     double input_shaper_get_step_generation_window(
         struct stepper_kinematics *sk);
     int input_shaper_set_shaper_params(struct stepper_kinematics *sk, char axis
@@ -165,6 +175,53 @@ defs_kin_idex = """
     struct stepper_kinematics * dual_carriage_alloc(void);
 """
 
+defs_kin_bed_mesh = """
+    struct bed_mesh_grid *bed_mesh_grid_alloc(void);
+    void bed_mesh_grid_free(struct bed_mesh_grid *g);
+    int bed_mesh_grid_set_matrix(struct bed_mesh_grid *g, int x_count
+        , int y_count, double z_matrix[], double min_x, double min_y
+        , double dist_x, double dist_y);
+    void bed_mesh_grid_set_params(struct bed_mesh_grid *g, double offset_x
+        , double offset_y, double fade_start, double fade_end
+        , double fade_target, double tool_offset);
+    double bed_mesh_grid_calc_z(struct bed_mesh_grid *g, double x
+        , double y);
+    void bed_mesh_grid_calc_z_batch(struct bed_mesh_grid *g, int count
+        , double xy[], double z[]);
+    double bed_mesh_grid_calc_adjust(struct bed_mesh_grid *g, double x
+        , double y, double z);
+    double bed_mesh_grid_calc_z_rate(struct bed_mesh_grid *g
+        , double start[3], double end[3], double check_dist);
+    #define BM_ALGO_LAGRANGE 0
+    #define BM_ALGO_BICUBIC 1
+    int bed_mesh_upsample(double out[], double probed[], int px_count
+        , int py_count, int x_mult, int y_mult, int algo, double tension);
+    int bed_mesh_set_sk(struct stepper_kinematics *sk
+        , struct stepper_kinematics *orig_sk);
+    void bed_mesh_set_grid(struct stepper_kinematics *sk
+        , struct bed_mesh_grid *grid);
+    struct stepper_kinematics * bed_mesh_alloc(void);
+"""
+
+defs_eddy_curve = """
+    struct eddy_curve *eddy_curve_alloc(void);
+    void eddy_curve_free(struct eddy_curve *ec);
+    int eddy_curve_set(struct eddy_curve *ec, int count, double freqs[]
+        , double zpos[], double out_of_range);
+    double eddy_curve_freq_to_height(struct eddy_curve *ec, double freq);
+    void eddy_curve_freq_to_height_batch(struct eddy_curve *ec, int count
+        , double freqs[], double heights[]);
+    double eddy_curve_height_to_freq(struct eddy_curve *ec, double height);
+    struct eddy_drift *eddy_drift_alloc(void);
+    void eddy_drift_free(struct eddy_drift *d);
+    int eddy_drift_set_table(struct eddy_drift *d, int curve_count
+        , int temp_count, double freqs[], double min_temp, double temp_step
+        , double min_freq);
+    int eddy_drift_calc_freqs(struct eddy_drift *d, int count
+        , double freqs[], double out[], double origin_temp
+        , double dest_temp);
+"""
+
 defs_serialqueue = """
     #define MESSAGE_MAX 64
     struct pull_queue_message {
@@ -223,7 +280,8 @@ defs_all = [
     defs_itersolve, defs_trapq, defs_trdispatch,
     defs_kin_cartesian, defs_kin_corexy, defs_kin_corexz, defs_kin_delta,
     defs_kin_deltesian, defs_kin_polar, defs_kin_rotary_delta, defs_kin_winch,
-    defs_kin_extruder, defs_kin_shaper, defs_kin_idex,
+    defs_kin_extruder, defs_kin_shaper, defs_kin_idex, defs_kin_bed_mesh,
+    defs_eddy_curve,
 ]
 
 # Update filenames to an absolute path
@@ -0,0 +1,298 @@
+// Eddy current sensor frequency to height conversion
+//
+// Copyright (C) 2026  pulponair <pulponair@users.noreply.github.com>
+//
+// This file may be distributed under the terms of the GNU GPLv3 license.
+
+#include <math.h> // floor, fmax, fmin, round
+#include <stdlib.h> // malloc
+#include <string.h> // memcpy, memset
+#include "compiler.h" // __visible
+
+// The calibration table is interpolated with a monotone cubic
+// (Fritsch-Butland) spline, so the curve passes through every
+// calibration point without overshooting between them.
+struct eddy_curve {
+    int count;
+    double *freqs;
+    // Cubic coefficients of each segment (z0, c1, c2, c3)
+    double *coeffs;
+    double out_of_range;
+};
+
+struct eddy_curve * __visible
+eddy_curve_alloc(void)
+{
+    struct eddy_curve *ec = malloc(sizeof(*ec));
+    memset(ec, 0, sizeof(*ec));
+    return ec;
+}
+
+void __visible
+eddy_curve_free(struct eddy_curve *ec)
+{
+    free(ec->freqs);
+    free(ec->coeffs);
+    free(ec);
+}
+
+// Store a calibration table (sorted by ascending frequency)
+int __visible
+eddy_curve_set(struct eddy_curve *ec, int count, double freqs[]
+               , double zpos[], double out_of_range)
+{
+    ec->out_of_range = out_of_range;
+    if (count < 2) {
+        // Not calibrated
+        ec->count = 0;
+        return 0;
+    }
+    double *f = malloc(sizeof(*f) * count);
+    double *coeffs = malloc(sizeof(*coeffs) * 4 * (count - 1));
+    double *slopes = malloc(sizeof(*slopes) * count);
+    if (!f || !coeffs || !slopes) {
+        free(f);
+        free(coeffs);
+        free(slopes);
+        return -1;
+    }
+    int i;
+    for (i = 0; i < count - 1; i++) {
+        double h = freqs[i+1] - freqs[i];
+        if (h < 0.) {
+            free(f);
+            free(coeffs);
+            free(slopes);
+            return -1;
+        }
+        // Duplicate frequencies give an empty (never used) segment
+        slopes[i] = h ? (zpos[i+1] - zpos[i]) / h : 0.;
+    }
+    // Find the tangent at each point (stored in the segment coeffs)
+    for (i = 0; i < count; i++) {
+        double m;
+        if (!i)
+            m = slopes[0];
+        else if (i == count - 1)
+            m = slopes[count - 2];
+        else {
+            double d0 = slopes[i-1], d1 = slopes[i];
+            double h0 = freqs[i] - freqs[i-1], h1 = freqs[i+1] - freqs[i];
+            if (d0 * d1 <= 0.)
+                m = 0.;
+            else
+                m = 3. * (h0 + h1) / ((2.*h1 + h0) / d0 + (h1 + 2.*h0) / d1);
+        }
+        if (i < count - 1)
+            coeffs[4*i + 1] = m;
+        if (i)
+            coeffs[4*(i-1) + 3] = m;
+    }
+    for (i = 0; i < count - 1; i++) {
+        double *c = &coeffs[4*i], h = freqs[i+1] - freqs[i];
+        double m0 = c[1], m1 = c[3], d = slopes[i];
+        c[0] = zpos[i];
+        if (!h) {
+            c[1] = c[2] = c[3] = 0.;
+            continue;
+        }
+        c[2] = (3.*d - 2.*m0 - m1) / h;
+        c[3] = (m0 + m1 - 2.*d) / (h * h);
+    }
+    memcpy(f, freqs, sizeof(*f) * count);
+    free(slopes);
+    free(ec->freqs);
+    free(ec->coeffs);
+    ec->freqs = f;
+    ec->coeffs = coeffs;
+    ec->count = count;
+    return 0;
+}
+
+// Find the last calibration point with a frequency at or below freq
+static int
+find_segment(struct eddy_curve *ec, double freq)
+{
+    int lo = 0, hi = ec->count - 1;
+    while (hi - lo > 1) {
+        int mid = (lo + hi) / 2;
+        if (ec->freqs[mid] <= freq)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static inline double
+calc_segment(double *c, double t)
+{
+    return c[0] + t * (c[1] + t * (c[2] + t * c[3]));
+}
+
+// Height (in mm, rounded to 6 decimals) for a sensor frequency
+double __visible
+eddy_curve_freq_to_height(struct eddy_curve *ec, double freq)
+{
+    int count = ec->count;
+    if (!count || freq >= ec->freqs[count - 1])
+        return -ec->out_of_range;
+    if (freq < ec->freqs[0])
+        return ec->out_of_range;
+    int seg = find_segment(ec, freq);
+    double z = calc_segment(&ec->coeffs[4*seg], freq - ec->freqs[seg]);
+    return round(z * 1000000.) / 1000000.;
+}
+
+void __visible
+eddy_curve_freq_to_height_batch(struct eddy_curve *ec, int count
+                                , double freqs[], double heights[])
+{
+    int i;
+    for (i = 0; i < count; i++)
+        heights[i] = eddy_curve_freq_to_height(ec, freqs[i]);
+}
+
+// Sensor frequency for a height (the inverse of the curve).  Returns
+// a negative value if the height is outside the calibrated range.
+double __visible
+eddy_curve_height_to_freq(struct eddy_curve *ec, double height)
+{
+    // Search from the highest frequency (closest to the bed)
+    int seg;
+    for (seg = ec->count - 2; seg >= 0; seg--) {
+        double *c = &ec->coeffs[4*seg];
+        double h = ec->freqs[seg+1] - ec->freqs[seg];
+        double z0 = c[0], z1 = calc_segment(c, h);
+        // Allow for rounding error at the calibration points
+        if (!h || height < fmin(z0, z1) - 1e-9 || height > fmax(z0, z1) + 1e-9)
+            continue;
+        // The segment is monotone - bisect to find the frequency
+        double lo = 0., hi = h, dir = z1 >= z0 ? 1. : -1.;
+        int i;
+        for (i = 0; i < 60 && hi - lo > 1e-9 * h; i++) {
+            double mid = .5 * (lo + hi);
+            if ((calc_segment(c, mid) - height) * dir < 0.)
+                lo = mid;
+            else
+                hi = mid;
+        }
+        return ec->freqs[seg] + .5 * (lo + hi);
+    }
+    return -1.;
+}
+
+
+/****************************************************************
+ * Temperature drift compensation
+ ****************************************************************/
+
+// The drift calibration is a set of curves, each giving the sensor
+// frequency (at a fixed height) versus coil temperature.  The curves
+// are stored as a table sampled at regular temperature intervals
+// (temp_count rows of curve_count frequencies, highest frequency
+// first) and are linearly interpolated between rows.
+struct eddy_drift {
+    int curve_count, temp_count;
+    double *freqs;
+    double min_temp, temp_step, min_freq;
+};
+
+struct eddy_drift * __visible
+eddy_drift_alloc(void)
+{
+    struct eddy_drift *d = malloc(sizeof(*d));
+    memset(d, 0, sizeof(*d));
+    return d;
+}
+
+void __visible
+eddy_drift_free(struct eddy_drift *d)
+{
+    free(d->freqs);
+    free(d);
+}
+
+int __visible
+eddy_drift_set_table(struct eddy_drift *d, int curve_count, int temp_count
+                     , double freqs[], double min_temp, double temp_step
+                     , double min_freq)
+{
+    if (curve_count < 1 || temp_count < 2 || temp_step <= 0.)
+        return -1;
+    int size = curve_count * temp_count;
+    double *f = malloc(sizeof(*f) * size);
+    if (!f)
+        return -1;
+    memcpy(f, freqs, sizeof(*f) * size);
+    free(d->freqs);
+    d->freqs = f;
+    d->curve_count = curve_count;
+    d->temp_count = temp_count;
+    d->min_temp = min_temp;
+    d->temp_step = temp_step;
+    d->min_freq = min_freq;
+    return 0;
+}
+
+// Frequency of each curve at a temperature (extrapolated linearly
+// beyond the ends of the table)
+static void
+calc_curve_freqs(struct eddy_drift *d, double temp, double *out)
+{
+    double pos = (temp - d->min_temp) / d->temp_step;
+    int row = floor(pos);
+    if (row < 0)
+        row = 0;
+    else if (row > d->temp_count - 2)
+        row = d->temp_count - 2;
+    double t = pos - row;
+    double *r0 = &d->freqs[row * d->curve_count], *r1 = r0 + d->curve_count;
+    int i;
+    for (i = 0; i < d->curve_count; i++)
+        out[i] = r0[i] + t * (r1[i] - r0[i]);
+}
+
+// Map a frequency between curves measured at origin temperature to
+// the frequency at the same relative position at dest temperature
+static double
+calc_drift(struct eddy_drift *d, double *origin, double *dest, double freq)
+{
+    if (freq < d->min_freq)
+        return freq;
+    if (freq >= origin[0])
+        // Frequency above max calibration value
+        return freq + dest[0] - origin[0];
+    int i;
+    for (i = 1; i < d->curve_count; i++) {
+        double low = origin[i], high = origin[i-1];
+        if (freq < low)
+            continue;
+        double t = high > low ? (freq - low) / (high - low) : 1.;
+        t = t > 1. ? 1. : t;
+        return (1. - t) * dest[i] + t * dest[i-1];
+    }
+    // Frequency below minimum, no correction
+    return freq;
+}
+
+// Convert frequencies sampled at origin_temp to the frequencies the
+// sensor would report at dest_temp
+int __visible
+eddy_drift_calc_freqs(struct eddy_drift *d, int count, double freqs[]
+                      , double out[], double origin_temp, double dest_temp)
+{
+    int cc = d->curve_count;
+    if (!cc)
+        return -1;
+    double *origin = malloc(sizeof(*origin) * 2 * cc), *dest = origin + cc;
+    if (!origin)
+        return -1;
+    calc_curve_freqs(d, origin_temp, origin);
+    calc_curve_freqs(d, dest_temp, dest);
+    int i;
+    for (i = 0; i < count; i++)
+        out[i] = calc_drift(d, origin, dest, freqs[i]);
+    free(origin);
+    return 0;
+}
@@ -0,0 +1,361 @@
+// Bed mesh z adjustment applied during step generation
+//
+// Copyright (C) 2026  pulponair <pulponair@users.noreply.github.com>
+//
+// This file may be distributed under the terms of the GNU GPLv3 license.
+
+#include <math.h> // ceil, fabs, floor, sqrt
+#include <stddef.h> // offsetof
+#include <stdlib.h> // malloc
+#include <string.h> // memset
+#include "compiler.h" // __visible
+#include "itersolve.h" // struct stepper_kinematics
+#include "trapq.h" // struct move
+
+
+/****************************************************************
+ * Mesh grid
+ ****************************************************************/
+
+struct bed_mesh_grid {
+    int x_count, y_count;
+    // Bilinear coefficients of each cell (z00, dx, dy, dxy)
+    double *coeffs;
+    double min_x, min_y, dist_x, dist_y;
+    double offset_x, offset_y;
+    double fade_start, fade_end, fade_target, tool_offset;
+};
+
+struct bed_mesh_grid * __visible
+bed_mesh_grid_alloc(void)
+{
+    struct bed_mesh_grid *g = malloc(sizeof(*g));
+    memset(g, 0, sizeof(*g));
+    return g;
+}
+
+void __visible
+bed_mesh_grid_free(struct bed_mesh_grid *g)
+{
+    free(g->coeffs);
+    free(g);
+}
+
+// Store the interpolated mesh (row major, with y_count rows)
+int __visible
+bed_mesh_grid_set_matrix(struct bed_mesh_grid *g, int x_count, int y_count
+                         , double z_matrix[], double min_x, double min_y
+                         , double dist_x, double dist_y)
+{
+    if (x_count < 2 || y_count < 2 || dist_x <= 0. || dist_y <= 0.)
+        return -1;
+    int cells = (x_count - 1) * (y_count - 1);
+    double *coeffs = malloc(sizeof(*coeffs) * 4 * cells);
+    if (!coeffs)
+        return -1;
+    double *c = coeffs;
+    int x, y;
+    for (y = 0; y < y_count - 1; y++) {
+        double *row0 = &z_matrix[y * x_count], *row1 = row0 + x_count;
+        for (x = 0; x < x_count - 1; x++, c += 4) {
+            c[0] = row0[x];
+            c[1] = row0[x+1] - row0[x];
+            c[2] = row1[x] - row0[x];
+            c[3] = row1[x+1] - row1[x] - c[1];
+        }
+    }
+    free(g->coeffs);
+    g->coeffs = coeffs;
+    g->x_count = x_count;
+    g->y_count = y_count;
+    g->min_x = min_x;
+    g->min_y = min_y;
+    g->dist_x = dist_x;
+    g->dist_y = dist_y;
+    return 0;
+}
+
+void __visible
+bed_mesh_grid_set_params(struct bed_mesh_grid *g, double offset_x
+                         , double offset_y, double fade_start
+                         , double fade_end, double fade_target
+                         , double tool_offset)
+{
+    g->offset_x = offset_x;
+    g->offset_y = offset_y;
+    g->fade_start = fade_start;
+    g->fade_end = fade_end;
+    g->fade_target = fade_target;
+    g->tool_offset = tool_offset;
+}
+
+// Find the grid cell and the position within it for a coordinate
+static inline int
+get_linear_index(double coord, double min, double dist, int count, double *t)
+{
+    int idx = floor((coord - min) / dist);
+    if (idx < 0)
+        idx = 0;
+    else if (idx > count - 2)
+        idx = count - 2;
+    double lt = (coord - (min + dist * idx)) / dist;
+    *t = lt < 0. ? 0. : (lt > 1. ? 1. : lt);
+    return idx;
+}
+
+// Bilinear interpolation of the mesh (same as ZMesh.calc_z())
+static double
+calc_mesh_z(struct bed_mesh_grid *g, double x, double y)
+{
+    double tx, ty;
+    int xidx = get_linear_index(x + g->offset_x, g->min_x, g->dist_x
+                                , g->x_count, &tx);
+    int yidx = get_linear_index(y + g->offset_y, g->min_y, g->dist_y
+                                , g->y_count, &ty);
+    double *c = &g->coeffs[4 * (yidx * (g->x_count - 1) + xidx)];
+    return c[0] + tx * c[1] + ty * (c[2] + tx * c[3]);
+}
+
+// Mesh z at a position (without fade)
+double __visible
+bed_mesh_grid_calc_z(struct bed_mesh_grid *g, double x, double y)
+{
+    if (!g->coeffs)
+        return 0.;
+    return calc_mesh_z(g, x, y);
+}
+
+// Mesh z at a list of positions (xy pairs)
+void __visible
+bed_mesh_grid_calc_z_batch(struct bed_mesh_grid *g, int count, double xy[]
+                           , double z[])
+{
+    int i;
+    for (i = 0; i < count; i++)
+        z[i] = bed_mesh_grid_calc_z(g, xy[2*i], xy[2*i+1]);
+}
+
+// Z adjustment at a position (same as BedMesh.move() would apply)
+double __visible
+bed_mesh_grid_calc_adjust(struct bed_mesh_grid *g, double x, double y
+                          , double z)
+{
+    if (!g->coeffs)
+        return 0.;
+    double fade_z = z + g->tool_offset, factor = 1.;
+    if (fade_z >= g->fade_end)
+        factor = 0.;
+    else if (fade_z >= g->fade_start)
+        factor = (g->fade_end - fade_z) / (g->fade_end - g->fade_start);
+    double adj = g->fade_target;
+    if (factor)
+        adj += factor * (calc_mesh_z(g, x, y) - g->fade_target);
+    return adj;
+}
+
+// Maximum rate of change of the adjusted z height (in mm of z per mm
+// of travel) along a move, checked at intervals of up to check_dist
+double __visible
+bed_mesh_grid_calc_z_rate(struct bed_mesh_grid *g, double start[3]
+                          , double end[3], double check_dist)
+{
+    double dx = end[0] - start[0], dy = end[1] - start[1];
+    double dz = end[2] - start[2];
+    double move_d = sqrt(dx*dx + dy*dy + dz*dz);
+    if (!g->coeffs || move_d <= 0.)
+        return 0.;
+    int count = ceil(move_d / check_dist), i;
+    double seg_d = move_d / count, max_rate = 0.;
+    double last_z = start[2] + bed_mesh_grid_calc_adjust(
+        g, start[0], start[1], start[2]);
+    for (i = 1; i <= count; i++) {
+        double r = (double)i / count;
+        double x = start[0] + dx * r, y = start[1] + dy * r;
+        double z = start[2] + dz * r;
+        z += bed_mesh_grid_calc_adjust(g, x, y, z);
+        double rate = fabs(z - last_z) / seg_d;
+        if (rate > max_rate)
+            max_rate = rate;
+        last_z = z;
+    }
+    return max_rate;
+}
+
+
+/****************************************************************
+ * Mesh upsampling
+ ****************************************************************/
+
+enum { BM_ALGO_LAGRANGE, BM_ALGO_BICUBIC };
+
+// Fill the weights of each probed point for every interpolated point
+// along one axis.  Points are in units of mesh indexes; the probed
+// points are located at multiples of 'mult'.
+static void
+calc_axis_weights(double *w, int pcount, int mult, int algo, double tension)
+{
+    int count = (pcount - 1) * mult + 1, i, k, j;
+    memset(w, 0, sizeof(*w) * count * pcount);
+    for (i = 0; i < count; i++, w += pcount) {
+        if (!(i % mult)) {
+            w[i / mult] = 1.;
+            continue;
+        }
+        if (algo == BM_ALGO_LAGRANGE) {
+            for (k = 0; k < pcount; k++) {
+                double n = 1., d = 1.;
+                for (j = 0; j < pcount; j++) {
+                    if (j == k)
+                        continue;
+                    n *= i - j * mult;
+                    d *= (k - j) * mult;
+                }
+                w[k] = n / d;
+            }
+            continue;
+        }
+        // Cardinal spline between probed points seg and seg+1
+        int seg = i / mult, p[4];
+        double t = (i - seg * mult) / (double)mult, t2 = t * t, t3 = t2 * t;
+        double h00 = 2.*t3 - 3.*t2 + 1., h01 = -2.*t3 + 3.*t2;
+        double h10 = t3 - 2.*t2 + t, h11 = t3 - t2;
+        for (k = 0; k < 4; k++) {
+            int idx = seg - 1 + k;
+            p[k] = idx < 0 ? 0 : (idx > pcount - 1 ? pcount - 1 : idx);
+        }
+        w[p[0]] -= tension * h10;
+        w[p[1]] += h00 - tension * h11;
+        w[p[2]] += h01 + tension * h10;
+        w[p[3]] += tension * h11;
+    }
+}
+
+// Interpolate a probed matrix (row major, py_count rows) into a mesh
+// of ((px_count-1)*x_mult+1) x ((py_count-1)*y_mult+1) points.  The
+// interpolation is separable, so the mesh is the product of the
+// probed matrix with a weight matrix for each axis.
+int __visible
+bed_mesh_upsample(double out[], double probed[], int px_count, int py_count
+                  , int x_mult, int y_mult, int algo, double tension)
+{
+    if (px_count < 2 || py_count < 2 || x_mult < 1 || y_mult < 1)
+        return -1;
+    int x_count = (px_count - 1) * x_mult + 1;
+    int y_count = (py_count - 1) * y_mult + 1;
+    double *wx = malloc(sizeof(*wx) * x_count * px_count);
+    double *wy = malloc(sizeof(*wy) * y_count * py_count);
+    double *rows = malloc(sizeof(*rows) * py_count * x_count);
+    if (!wx || !wy || !rows) {
+        free(wx);
+        free(wy);
+        free(rows);
+        return -1;
+    }
+    calc_axis_weights(wx, px_count, x_mult, algo, tension);
+    calc_axis_weights(wy, py_count, y_mult, algo, tension);
+    // Interpolate along x on the probed rows
+    int x, y, k;
+    for (y = 0; y < py_count; y++) {
+        double *prow = &probed[y * px_count], *row = &rows[y * x_count];
+        for (x = 0; x < x_count; x++) {
+            double *w = &wx[x * px_count], z = 0.;
+            for (k = 0; k < px_count; k++)
+                z += w[k] * prow[k];
+            row[x] = z;
+        }
+    }
+    // Interpolate along y
+    for (y = 0; y < y_count; y++) {
+        double *w = &wy[y * py_count], *orow = &out[y * x_count];
+        memset(orow, 0, sizeof(*orow) * x_count);
+        for (k = 0; k < py_count; k++) {
+            if (!w[k])
+                continue;
+            double *row = &rows[k * x_count];
+            for (x = 0; x < x_count; x++)
+                orow[x] += w[k] * row[x];
+        }
+    }
+    free(wx);
+    free(wy);
+    free(rows);
+    return 0;
+}
+
+
+/****************************************************************
+ * Kinematics wrapper
+ ****************************************************************/
+
+#define DUMMY_T 500.0
+
+struct bed_mesh_sk {
+    struct stepper_kinematics sk;
+    struct stepper_kinematics *orig_sk;
+    struct bed_mesh_grid *grid;
+    struct move m;
+};
+
+static double
+bed_mesh_passthrough_calc_position(struct stepper_kinematics *sk
+                                   , struct move *m, double move_time)
+{
+    struct bed_mesh_sk *bs = container_of(sk, struct bed_mesh_sk, sk);
+    return bs->orig_sk->calc_position_cb(bs->orig_sk, m, move_time);
+}
+
+static double
+bed_mesh_calc_position(struct stepper_kinematics *sk, struct move *m
+                       , double move_time)
+{
+    struct bed_mesh_sk *bs = container_of(sk, struct bed_mesh_sk, sk);
+    struct coord c = move_get_coord(m, move_time);
+    c.z += bed_mesh_grid_calc_adjust(bs->grid, c.x, c.y, c.z);
+    bs->m.start_pos = c;
+    return bs->orig_sk->calc_position_cb(bs->orig_sk, &bs->m, DUMMY_T);
+}
+
+int __visible
+bed_mesh_set_sk(struct stepper_kinematics *sk
+                , struct stepper_kinematics *orig_sk)
+{
+    if (!(orig_sk->active_flags & AF_Z))
+        return -1;
+    struct bed_mesh_sk *bs = container_of(sk, struct bed_mesh_sk, sk);
+    bs->orig_sk = orig_sk;
+    bs->grid = NULL;
+    bs->sk.calc_position_cb = bed_mesh_passthrough_calc_position;
+    bs->sk.active_flags = orig_sk->active_flags;
+    bs->sk.gen_steps_pre_active = orig_sk->gen_steps_pre_active;
+    bs->sk.gen_steps_post_active = orig_sk->gen_steps_post_active;
+    bs->sk.commanded_pos = orig_sk->commanded_pos;
+    bs->sk.last_flush_time = orig_sk->last_flush_time;
+    bs->sk.last_move_time = orig_sk->last_move_time;
+    return 0;
+}
+
+// Enable (or disable if grid is NULL) z adjustment.  This must only
+// be called after all pending steps have been generated.
+void __visible
+bed_mesh_set_grid(struct stepper_kinematics *sk, struct bed_mesh_grid *grid)
+{
+    struct bed_mesh_sk *bs = container_of(sk, struct bed_mesh_sk, sk);
+    bs->grid = grid;
+    if (grid) {
+        // XY moves now change the position of this stepper
+        bs->sk.calc_position_cb = bed_mesh_calc_position;
+        bs->sk.active_flags = bs->orig_sk->active_flags | AF_X | AF_Y;
+    } else {
+        bs->sk.calc_position_cb = bed_mesh_passthrough_calc_position;
+        bs->sk.active_flags = bs->orig_sk->active_flags;
+    }
+}
+
+struct stepper_kinematics * __visible
+bed_mesh_alloc(void)
+{
+    struct bed_mesh_sk *bs = malloc(sizeof(*bs));
+    memset(bs, 0, sizeof(*bs));
+    bs->m.move_t = 2. * DUMMY_T;
+    return &bs->sk;
+}
@@ -41,7 +41,7 @@ shift_pulses(struct shaper_pulses *sp)
 static int
 init_shaper(int n, double a[], double t[], struct shaper_pulses *sp)
 {
-    if (n < 0 || n > ARRAY_SIZE(sp->pulses)) {
+    if (n < 0 || n > (int)ARRAY_SIZE(sp->pulses)) {
         sp->num_pulses = 0;
         return -1;
     }
@@ -61,6 +61,110 @@ init_shaper(int n, double a[], double t[], struct shaper_pulses *sp)
 }
 
 
+/****************************************************************
+ * Position dependent shaper frequency
+ ****************************************************************/
+
+// A grid of shaper frequencies across the bed.  The shaper pulses are
+// configured for 'ref_freq' (the lowest frequency in the grid) and the
+// pulse times are scaled by ref_freq / freq at the toolhead position.
+struct shaper_freq_map {
+    int x_count, y_count;
+    double *freqs;
+    double min_x, min_y, dist_x, dist_y, ref_freq;
+};
+
+struct shaper_freq_map * __visible
+shaper_freq_map_alloc(void)
+{
+    struct shaper_freq_map *fm = malloc(sizeof(*fm));
+    memset(fm, 0, sizeof(*fm));
+    return fm;
+}
+
+void __visible
+shaper_freq_map_free(struct shaper_freq_map *fm)
+{
+    free(fm->freqs);
+    free(fm);
+}
+
+// Store the frequency grid (row major, with y_count rows)
+int __visible
+shaper_freq_map_set(struct shaper_freq_map *fm, int x_count, int y_count
+                    , double freqs[], double min_x, double min_y
+                    , double max_x, double max_y, double ref_freq)
+{
+    if (x_count < 1 || y_count < 1 || ref_freq <= 0.
+        || max_x < min_x || max_y < min_y)
+        return -1;
+    int i, count = x_count * y_count;
+    for (i = 0; i < count; i++)
+        if (freqs[i] < ref_freq)
+            return -1;
+    double *f = malloc(sizeof(*f) * count);
+    if (!f)
+        return -1;
+    memcpy(f, freqs, sizeof(*f) * count);
+    free(fm->freqs);
+    fm->freqs = f;
+    fm->x_count = x_count;
+    fm->y_count = y_count;
+    fm->min_x = min_x;
+    fm->min_y = min_y;
+    fm->dist_x = x_count > 1 ? (max_x - min_x) / (x_count - 1) : 0.;
+    fm->dist_y = y_count > 1 ? (max_y - min_y) / (y_count - 1) : 0.;
+    fm->ref_freq = ref_freq;
+    return 0;
+}
+
+// Find the grid cell and the position within it for a coordinate
+static inline int
+get_map_index(double coord, double min, double dist, int count, double *t)
+{
+    if (count < 2 || dist <= 0.) {
+        *t = 0.;
+        return 0;
+    }
+    double pos = (coord - min) / dist;
+    if (pos <= 0.) {
+        *t = 0.;
+        return 0;
+    }
+    if (pos >= count - 1) {
+        *t = 1.;
+        return count - 2;
+    }
+    int idx = pos;
+    *t = pos - idx;
+    return idx;
+}
+
+// Bilinear interpolation of the frequency at a position
+double __visible
+shaper_freq_map_calc_freq(struct shaper_freq_map *fm, double x, double y)
+{
+    double tx, ty;
+    int xi = get_map_index(x, fm->min_x, fm->dist_x, fm->x_count, &tx);
+    int yi = get_map_index(y, fm->min_y, fm->dist_y, fm->y_count, &ty);
+    int xn = fm->x_count > 1 ? 1 : 0, yn = fm->y_count > 1 ? fm->x_count : 0;
+    double *f = &fm->freqs[yi * fm->x_count + xi];
+    double f0 = f[0] + tx * (f[xn] - f[0]);
+    double f1 = f[yn] + tx * (f[yn + xn] - f[yn]);
+    return f0 + ty * (f1 - f0);
+}
+
+// Return the scale of the pulse times at the position of a move
+static inline double
+get_pulses_scale(struct shaper_freq_map *fm, struct move *m, double move_time)
+{
+    if (!fm)
+        return 1.;
+    struct coord c = move_get_coord(m, move_time);
+    return fm->ref_freq / shaper_freq_map_calc_freq(fm, c.x, c.y);
+}
+
+
 /****************************************************************
  * Generic position calculation via shaper convolution
  ****************************************************************/
@@ -91,12 +195,12 @@ get_axis_position_across_moves(struct move *m, int axis, double time)
 // Calculate the position from the convolution of the shaper with input signal
 static inline double
 calc_position(struct move *m, int axis, double move_time
-              , struct shaper_pulses *sp)
+              , struct shaper_pulses *sp, double scale)
 {
     double res = 0.;
     int num_pulses = sp->num_pulses, i;
     for (i = 0; i < num_pulses; ++i) {
-        double t = sp->pulses[i].t, a = sp->pulses[i].a;
+        double t = sp->pulses[i].t * scale, a = sp->pulses[i].a;
         res += a * get_axis_position_across_moves(m, axis, move_time + t);
     }
     return res;
@@ -114,6 +218,7 @@ struct input_shaper {
     struct stepper_kinematics *orig_sk;
     struct move m;
     struct shaper_pulses sx, sy;
+    struct shaper_freq_map *fmx, *fmy;
 };
 
 // Optimized calc_position when only x axis is needed
@@ -124,7 +229,8 @@ shaper_x_calc_position(struct stepper_kinematics *sk, struct move *m
     struct input_shaper *is = container_of(sk, struct input_shaper, sk);
     if (!is->sx.num_pulses)
         return is->orig_sk->calc_position_cb(is->orig_sk, m, move_time);
-    is->m.start_pos.x = calc_position(m, 'x', move_time, &is->sx);
+    double scale = get_pulses_scale(is->fmx, m, move_time);
+    is->m.start_pos.x = calc_position(m, 'x', move_time, &is->sx, scale);
     return is->orig_sk->calc_position_cb(is->orig_sk, &is->m, DUMMY_T);
 }
 
@@ -136,7 +242,8 @@ shaper_y_calc_position(struct stepper_kinematics *sk, struct move *m
     struct input_shaper *is = container_of(sk, struct input_shaper, sk);
     if (!is->sy.num_pulses)
         return is->orig_sk->calc_position_cb(is->orig_sk, m, move_time);
-    is->m.start_pos.y = calc_position(m, 'y', move_time, &is->sy);
+    double scale = get_pulses_scale(is->fmy, m, move_time);
+    is->m.start_pos.y = calc_position(m, 'y', move_time, &is->sy, scale);
     return is->orig_sk->calc_position_cb(is->orig_sk, &is->m, DUMMY_T);
 }
 
@@ -149,10 +256,14 @@ shaper_xy_calc_position(struct stepper_kinematics *sk, struct move *m
     if (!is->sx.num_pulses && !is->sy.num_pulses)
         return is->orig_sk->calc_position_cb(is->orig_sk, m, move_time);
     is->m.start_pos = move_get_coord(m, move_time);
-    if (is->sx.num_pulses)
-        is->m.start_pos.x = calc_position(m, 'x', move_time, &is->sx);
-    if (is->sy.num_pulses)
-        is->m.start_pos.y = calc_position(m, 'y', move_time, &is->sy);
+    if (is->sx.num_pulses) {
+        double scale = get_pulses_scale(is->fmx, m, move_time);
+        is->m.start_pos.x = calc_position(m, 'x', move_time, &is->sx, scale);
+    }
+    if (is->sy.num_pulses) {
+        double scale = get_pulses_scale(is->fmy, m, move_time);
+        is->m.start_pos.y = calc_position(m, 'y', move_time, &is->sy, scale);
+    }
     return is->orig_sk->calc_position_cb(is->orig_sk, &is->m, DUMMY_T);
 }
 
@@ -212,6 +323,25 @@ input_shaper_set_shaper_params(struct stepper_kinematics *sk, char axis
     return status;
 }
 
+// Use a frequency map (or a fixed frequency if fm is NULL) for an
+// axis.  The shaper params of the axis must be set for the map's
+// reference frequency.
+int __visible
+input_shaper_set_freq_map(struct stepper_kinematics *sk, char axis
+                          , struct shaper_freq_map *fm)
+{
+    if (axis != 'x' && axis != 'y')
+        return -1;
+    if (fm && !fm->freqs)
+        return -1;
+    struct input_shaper *is = container_of(sk, struct input_shaper, sk);
+    if (axis == 'x')
+        is->fmx = fm;
+    else
+        is->fmy = fm;
+    return 0;
+}
+
 double __visible
 input_shaper_get_step_generation_window(struct stepper_kinematics *sk)
 {
@@ -4,10 +4,17 @@
 #
 # This file may be distributed under the terms of the GNU GPLv3 license.
 import logging, math
+import serialhdl
 
 RTT_AGE = .000010 / (60. * 60.)
 DECAY = 1. / 30.
 TRANSMIT_EXTRA = .001
+QUERY_TIME = .9839
+FAST_QUERY_TIME = .2459
+FAST_QUERY_RATIO = .25
+MIN_JITTER = .000050
+MIN_WEIGHT_AVG = .25
+MAIN_CONNECT_TIMEOUT = 5.
 
 class ClockSync:
     def __init__(self, reactor):
@@ -27,6 +34,9 @@ class ClockSync:
         self.clock_avg = self.clock_covariance = 0.
         self.prediction_variance = 0.
         self.last_prediction_time = 0.
+        # Round-trip-time jitter tracking (for sample weighting)
+        self.half_rtt_jitter = self.delayed_ratio = 0.
+        self.query_scale = 1.
     def connect(self, serial):
         self.serial = serial
         self.mcu_freq = serial.msgparser.get_constant_float('CLOCK_FREQ')
@@ -58,10 +68,16 @@ class ClockSync:
     # MCU clock querying (_handle_clock is invoked from background thread)
     def _get_clock_event(self, eventtime):
         self.serial.raw_send(self.get_clock_cmd, 0, 0, self.cmd_queue)
-        self.queries_pending += 1
+        self.queries_pending += self.query_scale
+        # Query more often when the round trip time is noisy (each
+        # sample then gets a proportionally smaller weight)
+        query_time = QUERY_TIME
+        if self.delayed_ratio > FAST_QUERY_RATIO:
+            query_time = FAST_QUERY_TIME
+        self.query_scale = query_time / QUERY_TIME
         # Use an unusual time for the next event so clock messages
         # don't resonate with other periodic events.
-        return eventtime + .9839
+        return eventtime + query_time
     def _handle_clock(self, params):
         self.queries_pending = 0
         # Extend clock to 64bit
@@ -80,6 +96,25 @@ class ClockSync:
             self.min_rtt_time = sent_time
             logging.debug("new minimum rtt %.3f: hrtt=%.6f freq=%d",
                           sent_time, half_rtt, self.clock_est[2])
+        # The mcu clock was sampled somewhere within the round trip, so
+        # samples with a delayed response are given less weight
+        rtt_excess = max(0., half_rtt - self.min_half_rtt - aged_rtt)
+        jitter = max(self.half_rtt_jitter, MIN_JITTER)
+        weight = 1.
+        if rtt_excess > 2. * jitter:
+            weight = (2. * jitter / rtt_excess)**2
+        self.delayed_ratio += DECAY * self.query_scale * (
+            (1. - weight) - self.delayed_ratio)
+        # Track the typical (lower quartile) excess delay
+        if rtt_excess > self.half_rtt_jitter:
+            self.half_rtt_jitter += .25 * DECAY * jitter
+        else:
+            self.half_rtt_jitter = max(
+                0., self.half_rtt_jitter - .75 * DECAY * jitter)
+        # Scale the weight so that the regression covers the same time
+        # span regardless of the query rate and number of delayed samples
+        decay = (DECAY * weight * self.query_scale
+                 / max(1. - self.delayed_ratio, MIN_WEIGHT_AVG))
         # Filter out samples that are extreme outliers
         exp_clock = ((sent_time - self.time_avg) * self.clock_est[2]
                      + self.clock_avg)
@@ -100,16 +135,16 @@ class ClockSync:
         else:
             self.last_prediction_time = sent_time
             self.prediction_variance = (
-                (1. - DECAY) * (self.prediction_variance + clock_diff2 * DECAY))
+                (1. - decay) * (self.prediction_variance + clock_diff2 * decay))
         # Add clock and sent_time to linear regression
         diff_sent_time = sent_time - self.time_avg
-        self.time_avg += DECAY * diff_sent_time
-        self.time_variance = (1. - DECAY) * (
-            self.time_variance + diff_sent_time**2 * DECAY)
+        self.time_avg += decay * diff_sent_time
+        self.time_variance = (1. - decay) * (
+            self.time_variance + diff_sent_time**2 * decay)
         diff_clock = clock - self.clock_avg
-        self.clock_avg += DECAY * diff_clock
-        self.clock_covariance = (1. - DECAY) * (
-            self.clock_covariance + diff_sent_time * diff_clock * DECAY)
+        self.clock_avg += decay * diff_clock
+        self.clock_covariance = (1. - decay) * (
+            self.clock_covariance + diff_sent_time * diff_clock * decay)
         # Update prediction from linear regression
         new_freq = self.clock_covariance / self.time_variance
         pred_stddev = math.sqrt(self.prediction_variance)
@@ -146,15 +181,20 @@ class ClockSync:
         return ("clocksync state: mcu_freq=%d last_clock=%d"
                 " clock_est=(%.3f %d %.3f) min_half_rtt=%.6f min_rtt_time=%.3f"
                 " time_avg=%.3f(%.3f) clock_avg=%.3f(%.3f)"
-                " pred_variance=%.3f" % (
-                    self.mcu_freq, self.last_clock, sample_time, clock, freq,
-                    self.min_half_rtt, self.min_rtt_time,
-                    self.time_avg, self.time_variance,
-                    self.clock_avg, self.clock_covariance,
-                    self.prediction_variance))
+                " pred_variance=%.3f half_rtt_jitter=%.6f delayed_ratio=%.3f"
+                % (self.mcu_freq, self.last_clock, sample_time, clock, freq,
+                   self.min_half_rtt, self.min_rtt_time,
+                   self.time_avg, self.time_variance,
+                   self.clock_avg, self.clock_covariance,
+                   self.prediction_variance, self.half_rtt_jitter,
+                   self.delayed_ratio))
     def stats(self, eventtime):
         sample_time, clock, freq = self.clock_est
-        return "freq=%d" % (freq,)
+        clock_stddev = math.sqrt(self.prediction_variance) / self.mcu_freq
+        return ("freq=%d clock_stddev=%.6f rtt_min=%.6f rtt_jitter=%.6f"
+                " rtt_delayed=%.3f" % (
+                    freq, clock_stddev, 2. * self.min_half_rtt,
+                    2. * self.half_rtt_jitter, self.delayed_ratio))
     def calibrate_clock(self, print_time, eventtime):
         return (0., self.mcu_freq)
 
@@ -169,6 +209,14 @@ class SecondarySync(ClockSync):
     def connect(self, serial):
         ClockSync.connect(self, serial)
         self.clock_adj = (0., self.mcu_freq)
+        # The main mcu clock may still be synchronizing concurrently
+        end_time = self.reactor.monotonic() + MAIN_CONNECT_TIMEOUT
+        while self.main_sync.get_clock_cmd is None:
+            curtime = self.reactor.monotonic()
+            if curtime > end_time:
+                raise serialhdl.error("Timeout waiting for main mcu clock"
+                                      " synchronization")
+            self.reactor.pause(curtime + 0.010)
         curtime = self.reactor.monotonic()
         main_print_time = self.main_sync.estimated_print_time(curtime)
         local_print_time = self.estimated_print_time(curtime)
@@ -39,20 +39,34 @@ class AccelQueryHelper:
         self.request_start_time = self.request_end_time = print_time
         self.msgs = []
         self.samples = []
+        self.psd_stream = None
+        self.keep_msgs = True
+    def set_psd_stream(self, psd_stream, keep_msgs=False):
+        # Pass samples to a shaper_calibrate.PSDStream as they arrive
+        self.psd_stream = psd_stream
+        self.keep_msgs = keep_msgs
     def finish_measurements(self):
         toolhead = self.printer.lookup_object('toolhead')
         self.request_end_time = toolhead.get_last_move_time()
+        if self.psd_stream is not None:
+            self.psd_stream.set_end_time(self.request_end_time)
         toolhead.wait_moves()
         self.is_finished = True
     def handle_batch(self, msg):
         if self.is_finished:
             return False
+        if self.psd_stream is not None:
+            self.psd_stream.add_samples(msg['data'])
+            if not self.keep_msgs:
+                return True
         if len(self.msgs) >= 10000:
             # Avoid filling up memory with too many samples
-            return False
+            return self.psd_stream is not None
         self.msgs.append(msg)
         return True
     def has_valid_samples(self):
+        if self.psd_stream is not None:
+            return self.psd_stream.has_samples()
         for msg in self.msgs:
             data = msg['data']
             first_sample_time = data[0][0]
@@ -4,6 +4,7 @@
 #
 # This file may be distributed under the terms of the GNU GPLv3 license.
 import logging, math, json, collections
+import chelper
 from . import probe
 
 PROFILE_VERSION = 1
@@ -34,6 +35,29 @@ def constrain(val, min_val, max_val):
 def lerp(t, v0, v1):
     return (1. - t) * v0 + t * v1
 
+# Solve the (symmetric) normal equations of a least squares fit.  Terms
+# that the samples do not constrain are set to zero.
+def solve_normal_equations(mat, vec):
+    n = len(vec)
+    m = [list(row) + [v] for row, v in zip(mat, vec)]
+    scale = max([m[i][i] for i in range(n)])
+    for k in range(n):
+        if m[k][k] <= 1e-9 * scale:
+            for i in range(n):
+                m[k][i] = m[i][k] = 0.
+            m[k][k] = 1.
+            m[k][n] = 0.
+            continue
+        for i in range(k + 1, n):
+            f = m[i][k] / m[k][k]
+            for j in range(k, n + 1):
+                m[i][j] -= f * m[k][j]
+    res = [0.] * n
+    for k in range(n - 1, -1, -1):
+        res[k] = (m[k][n] - sum([m[k][j] * res[j]
+                                 for j in range(k + 1, n)])) / m[k][k]
+    return res
+
 # retreive commma separated pair from config
 def parse_config_pair(config, option, default, minval=None, maxval=None):
     pair = config.getintlist(option, (default, default))
@@ -105,6 +129,9 @@ class BedMesh:
         self.tool_offset = 0.
         self.gcode = self.printer.lookup_object('gcode')
         self.splitter = MoveSplitter(config, self.gcode)
+        self.step_comp = None
+        if config.getboolean('step_compensation', False):
+            self.step_comp = StepCompensation(config, self)
         # setup persistent storage
         self.pmgr = ProfileManager(config, self)
         self.save_profile = self.pmgr.save_profile
@@ -135,6 +162,7 @@ class BedMesh:
         self.toolhead = self.printer.lookup_object('toolhead')
         self.bmc.print_generated_points(logging.info)
     def set_mesh(self, mesh):
+        self.deactivate_step_compensation()
         if mesh is not None and self.fade_end != self.FADE_DISABLE:
             self.log_fade_complete = True
             if self.base_fade_target is None:
@@ -166,6 +194,7 @@ class BedMesh:
         self.tool_offset = 0.
         self.z_mesh = mesh
         self.splitter.initialize(mesh, self.fade_target)
+        self._update_step_compensation()
         # cache the current position before a transform takes place
         gcode_move = self.printer.lookup_object('gcode_move')
         gcode_move.reset_last_position()
@@ -178,9 +207,36 @@ class BedMesh:
             return (self.fade_end - z_pos) / self.fade_dist
         else:
             return 1.
+    def _update_step_compensation(self):
+        if self.step_comp is not None:
+            self.step_comp.set_mesh(self.z_mesh, self.fade_start,
+                                    self.fade_end, self.fade_target,
+                                    self.tool_offset,
+                                    self.splitter.move_check_distance)
+    def _activate_step_compensation(self):
+        # Switch the toolhead to the non-transformed coordinate frame
+        sc = self.step_comp
+        if (sc is None or sc.is_active() or self.z_mesh is None
+            or not sc.check_supported()):
+            return
+        pos = self.get_position()
+        sc.set_active(True)
+        self.toolhead.set_position(pos)
+    def deactivate_step_compensation(self):
+        # Switch the toolhead back to the physical coordinate frame
+        sc = self.step_comp
+        if sc is None or not sc.is_active():
+            return
+        pos = self.toolhead.get_position()
+        pos[2] += sc.calc_adjust(pos)
+        sc.set_active(False)
+        self.toolhead.set_position(pos)
     def get_position(self):
         # Return last, non-transformed position
-        if self.z_mesh is None:
+        if self.step_comp is not None and self.step_comp.is_active():
+            # Z adjustment is applied during step generation
+            self.last_position[:] = self.toolhead.get_position()
+        elif self.z_mesh is None:
             # No mesh calibrated, so send toolhead position
             self.last_position[:] = self.toolhead.get_position()
             self.last_position[2] -= self.fade_target
@@ -206,6 +262,16 @@ class BedMesh:
         return list(self.last_position)
     def move(self, newpos, speed):
         factor = self.get_z_factor(newpos[2])
+        if self.step_comp is not None and self.step_comp.is_active():
+            # Z adjustment is applied during step generation
+            if self.log_fade_complete and not factor:
+                self.log_fade_complete = False
+                logging.info("bed_mesh fade complete: Current Z: %.4f"
+                             " fade_target: %.4f"
+                             % (newpos[2], self.fade_target))
+            self.toolhead.move(newpos, speed)
+            self.last_position[:] = newpos
+            return
         if self.z_mesh is None or not factor:
             # No mesh calibrated, or mesh leveling phased out.
             x, y, z, e = newpos
@@ -225,6 +291,7 @@ class BedMesh:
                     raise self.gcode.error(
                         "Mesh Leveling: Error splitting move ")
         self.last_position[:] = newpos
+        self._activate_step_compensation()
     def get_status(self, eventtime=None):
         return self.status
     def update_status(self):
@@ -276,6 +343,7 @@ class BedMesh:
     cmd_BED_MESH_OFFSET_help = "Add X/Y offsets to the mesh lookup"
     def cmd_BED_MESH_OFFSET(self, gcmd):
         if self.z_mesh is not None:
+            self.deactivate_step_compensation()
             offsets = [None, None]
             for i, axis in enumerate(['X', 'Y']):
                 offsets[i] = gcmd.get_float(axis, None)
@@ -283,6 +351,7 @@ class BedMesh:
             tool_offset = gcmd.get_float("ZFADE", None)
             if tool_offset is not None:
                 self.tool_offset = tool_offset
+            self._update_step_compensation()
             gcode_move = self.printer.lookup_object('gcode_move')
             gcode_move.reset_last_position()
         else:
@@ -815,6 +884,7 @@ class ProbeManager:
         )
         self.zref_mode = ZrefMode.DISABLED
         self.base_points = []
+        self.point_dist = (0., 0.)
         self.substitutes = collections.OrderedDict()
         self.is_round = orig_config["radius"] is not None
         self.probe_helper = probe.ProbePointsHelper(config, finalize_cb, [])
@@ -936,6 +1006,7 @@ class ProbeManager:
             # Zero Reference position outside of mesh
             self.zref_mode = ZrefMode.PROBE
         self.base_points = points
+        self.point_dist = (x_dist, y_dist)
         self.substitutes.clear()
         # adjust overshoot
         og_min_x = self.orig_config["mesh_min"][0]
@@ -1003,6 +1074,9 @@ class ProbeManager:
     def get_base_points(self):
         return self.base_points
 
+    def get_point_distance(self):
+        return self.point_dist
+
     def get_std_path(self):
         path = []
         for idx, pt in enumerate(self.base_points):
@@ -1204,23 +1278,80 @@ class RapidScanHelper:
         )
         gcmd_params = gcmd.get_command_parameters()
         gcmd_params["SAMPLE_TIME"] = half_window * 2
+        dense = gcmd.get_int("DENSE", 0, minval=0, maxval=1)
+        if dense and self.probe_manager.get_substitutes():
+            gcmd.respond_info(
+                "Dense scan not available with faulty regions, "
+                "using probe point sampling")
+            dense = 0
         self._raise_tool(gcmd, scan_height)
         probe_session = pprobe.start_probe_session(gcmd)
         offsets = pprobe.get_offsets()
         initial_move = True
+        scan_points = []
         for pos, is_probe_pt in self.probe_manager.iter_rapid_path():
             pos = self._apply_offsets(pos[:2], offsets)
             toolhead.manual_move(pos, speed)
             if initial_move:
                 initial_move = False
                 self._move_to_scan_height(gcmd, scan_height)
+                if dense:
+                    probe_session.start_scan()
             if is_probe_pt:
-                probe_session.run_probe(gcmd)
-        results = probe_session.pull_probed_results()
+                if dense:
+                    scan_points.append(pos)
+                else:
+                    probe_session.run_probe(gcmd)
+        if dense:
+            samples = probe_session.pull_scan_samples()
+            results = self._fit_scan_samples(gcmd, samples, scan_points)
+        else:
+            results = probe_session.pull_probed_results()
         toolhead.get_last_move_time()
         self.finalize_callback(offsets, results)
         probe_session.end_probe_session()
 
+    def _fit_scan_samples(self, gcmd, samples, points):
+        # Estimate the height at each probe point with a weighted least
+        # squares plane fit of all samples within one point spacing
+        dist_x, dist_y = self.probe_manager.get_point_distance()
+        cells = {}
+        for samp in samples:
+            key = (int(math.floor(samp[0] / dist_x)),
+                   int(math.floor(samp[1] / dist_y)))
+            cells.setdefault(key, []).append(samp)
+        results = []
+        for px, py in points:
+            cx = int(math.floor(px / dist_x))
+            cy = int(math.floor(py / dist_y))
+            # Normal equations for z = c0 + c1*dx + c2*dy
+            mat = [[0.] * 3 for i in range(3)]
+            vec = [0.] * 3
+            for key in [(cx + i, cy + j) for i in (-1, 0, 1)
+                        for j in (-1, 0, 1)]:
+                for sx, sy, sz in cells.get(key, ()):
+                    dx = (sx - px) / dist_x
+                    dy = (sy - py) / dist_y
+                    if abs(dx) >= 1. or abs(dy) >= 1.:
+                        continue
+                    w = (1. - abs(dx)) * (1. - abs(dy))
+                    terms = (1., dx, dy)
+                    for i in range(3):
+                        for j in range(3):
+                            mat[i][j] += w * terms[i] * terms[j]
+                        vec[i] += w * terms[i] * sz
+            if not mat[0][0]:
+                raise gcmd.error(
+                    "bed_mesh: No scan samples near point (%.2f, %.2f)"
+                    % (px, py))
+            pos = [px, py, solve_normal_equations(mat, vec)[0]]
+            # Allow axis_twist_compensation to update results
+            self.printer.send_event("probe:update_results", pos)
+            results.append(pos)
+        gcmd.respond_info("Fit %d probe points from %d scan samples"
+                          % (len(results), len(samples)))
+        return results
+
     def _raise_tool(self, gcmd, scan_height):
         # If the nozzle is below scan height raise the tool
         toolhead = self.printer.lookup_object("toolhead")
@@ -1315,6 +1446,99 @@ class MoveSplitter:
             return None
 
 
+# Apply the mesh z adjustment continuously during step generation (via
+# a stepper kinematics wrapper on the z steppers) instead of splitting
+# moves.  While active, the toolhead position is not transformed.
+class StepCompensation:
+    def __init__(self, config, bedmesh):
+        self.printer = config.get_printer()
+        self.bedmesh = bedmesh
+        self.toolhead = None
+        self.mesh_sks = []
+        self.active = False
+        self.z_mesh = None
+        self.check_dist = 5.
+        self.max_z_velocity = self.max_z_accel = None
+        # Wrap the stepper kinematics before other wrappers (such as
+        # input_shaper) are added during klippy:connect
+        self.printer.register_event_handler("klippy:mcu_identify",
+                                            self._handle_mcu_identify)
+        # Homing and probing calculations use the physical position
+        self.printer.register_event_handler("homing:homing_move_begin",
+                                            self._handle_homing_move_begin)
+        self.printer.register_event_handler("probe:session_begin",
+                                            self._handle_probe_begin)
+    def _handle_mcu_identify(self):
+        self.toolhead = self.printer.lookup_object('toolhead')
+        kin = self.toolhead.get_kinematics()
+        self.max_z_velocity = getattr(kin, 'max_z_velocity', None)
+        self.max_z_accel = getattr(kin, 'max_z_accel', None)
+        ffi_main, ffi_lib = chelper.get_ffi()
+        for stepper in kin.get_steppers():
+            if not stepper.is_active_axis('z'):
+                continue
+            orig_sk = stepper.get_stepper_kinematics()
+            mesh_sk = ffi_main.gc(ffi_lib.bed_mesh_alloc(), ffi_lib.free)
+            if ffi_lib.bed_mesh_set_sk(mesh_sk, orig_sk) < 0:
+                continue
+            stepper.set_stepper_kinematics(mesh_sk)
+            self.mesh_sks.append((stepper, mesh_sk, orig_sk))
+    def _handle_homing_move_begin(self, hmove):
+        self.bedmesh.deactivate_step_compensation()
+    def _handle_probe_begin(self):
+        self.bedmesh.deactivate_step_compensation()
+    def check_supported(self):
+        if not self.mesh_sks or self.z_mesh is None:
+            return False
+        for stepper, mesh_sk, orig_sk in self.mesh_sks:
+            if stepper.get_stepper_kinematics() == mesh_sk:
+                continue
+            # Another wrapper must also handle xy moves on this stepper
+            if (not stepper.is_active_axis('x')
+                or not stepper.is_active_axis('y')):
+                return False
+        return True
+    def is_active(self):
+        return self.active
+    def set_active(self, active):
+        self.toolhead.flush_step_generation()
+        ffi_main, ffi_lib = chelper.get_ffi()
+        grid = self.z_mesh.grid if active else ffi_main.NULL
+        for stepper, mesh_sk, orig_sk in self.mesh_sks:
+            ffi_lib.bed_mesh_set_grid(mesh_sk, grid)
+        self.active = active
+        self.toolhead.set_step_transform(self if active else None)
+    def set_mesh(self, z_mesh, fade_start, fade_end, fade_target,
+                 tool_offset, check_dist):
+        self.z_mesh = None
+        if z_mesh is None or z_mesh.mesh_matrix is None:
+            return
+        z_mesh.set_fade_params(fade_start, fade_end, fade_target,
+                               tool_offset)
+        self.z_mesh = z_mesh
+        self.check_dist = check_dist
+    def calc_adjust(self, pos):
+        ffi_main, ffi_lib = chelper.get_ffi()
+        return ffi_lib.bed_mesh_grid_calc_adjust(self.z_mesh.grid,
+                                                 pos[0], pos[1], pos[2])
+    # Stepper transform interface (see toolhead.set_step_transform())
+    def calc_physical_position(self, pos):
+        pos = list(pos)
+        pos[2] += self.calc_adjust(pos)
+        return pos
+    def check_move(self, move):
+        # Limit the z velocity and acceleration caused by the mesh
+        if self.max_z_velocity is None:
+            return
+        ffi_main, ffi_lib = chelper.get_ffi()
+        z_rate = ffi_lib.bed_mesh_grid_calc_z_rate(
+            self.z_mesh.grid, move.start_pos[:3], move.end_pos[:3],
+            self.check_dist)
+        if z_rate:
+            move.limit_speed(self.max_z_velocity / z_rate,
+                             self.max_z_accel / z_rate)
+
+
 class ZMesh:
     def __init__(self, params, name):
         self.profile_name = name or "adaptive-%X" % (id(self),)
@@ -1354,6 +1578,12 @@ class ZMesh:
                            (self.mesh_x_count - 1)
         self.mesh_y_dist = (self.mesh_y_max - self.mesh_y_min) / \
                            (self.mesh_y_count - 1)
+        ffi_main, ffi_lib = chelper.get_ffi()
+        self.grid = ffi_main.gc(ffi_lib.bed_mesh_grid_alloc(),
+                                ffi_lib.bed_mesh_grid_free)
+        self.calc_z_func = ffi_lib.bed_mesh_grid_calc_z
+        # Fade settings used by bed_mesh_grid_calc_adjust()
+        self.fade_params = (0., 0., 0., 0.)
     def get_mesh_matrix(self):
         if self.mesh_matrix is not None:
             return [[round(z, 6) for z in line]
@@ -1402,7 +1632,26 @@ class ZMesh:
     def build_mesh(self, z_matrix):
         self.probed_matrix = z_matrix
         self._sample(z_matrix)
+        self._update_grid()
         #self.print_mesh(logging.debug)
+    def _update_grid(self):
+        # Load the mesh into the C grid used for z lookups
+        ffi_main, ffi_lib = chelper.get_ffi()
+        ret = ffi_lib.bed_mesh_grid_set_matrix(
+            self.grid, self.mesh_x_count, self.mesh_y_count,
+            [z for line in self.mesh_matrix for z in line],
+            self.mesh_x_min, self.mesh_y_min,
+            self.mesh_x_dist, self.mesh_y_dist)
+        if ret:
+            raise BedMeshError("bed_mesh: Error loading mesh")
+        ffi_lib.bed_mesh_grid_set_params(
+            self.grid, self.mesh_offsets[0], self.mesh_offsets[1],
+            *self.fade_params)
+    def set_fade_params(self, fade_start, fade_end, fade_target,
+                        tool_offset):
+        self.fade_params = (fade_start, fade_end, fade_target, tool_offset)
+        if self.mesh_matrix is not None:
+            self._update_grid()
     def set_zero_reference(self, xpos, ypos):
         offset = self.calc_z(xpos, ypos)
         logging.info(
@@ -1413,25 +1662,28 @@ class ZMesh:
             for yidx in range(len(matrix)):
                 for xidx in range(len(matrix[yidx])):
                     matrix[yidx][xidx] -= offset
+        self._update_grid()
     def set_mesh_offsets(self, offsets):
         for i, o in enumerate(offsets):
             if o is not None:
                 self.mesh_offsets[i] = o
+        if self.mesh_matrix is not None:
+            self._update_grid()
     def get_x_coordinate(self, index):
         return self.mesh_x_min + self.mesh_x_dist * index
     def get_y_coordinate(self, index):
         return self.mesh_y_min + self.mesh_y_dist * index
     def calc_z(self, x, y):
-        if self.mesh_matrix is not None:
-            tbl = self.mesh_matrix
-            tx, xidx = self._get_linear_index(x + self.mesh_offsets[0], 0)
-            ty, yidx = self._get_linear_index(y + self.mesh_offsets[1], 1)
-            z0 = lerp(tx, tbl[yidx][xidx], tbl[yidx][xidx+1])
-            z1 = lerp(tx, tbl[yidx+1][xidx], tbl[yidx+1][xidx+1])
-            return lerp(ty, z0, z1)
-        else:
-            # No mesh table generated, no z-adjustment
-            return 0.
+        # Returns 0. (no z-adjustment) if no mesh table was generated
+        return self.calc_z_func(self.grid, x, y)
+    def calc_z_batch(self, points):
+        # Calculate the mesh z at a list of (x, y) positions
+        ffi_main, ffi_lib = chelper.get_ffi()
+        count = len(points)
+        zvals = ffi_main.new('double[]', count)
+        ffi_lib.bed_mesh_grid_calc_z_batch(
+            self.grid, count, [c for pt in points for c in pt[:2]], zvals)
+        return list(zvals)
     def get_z_range(self):
         if self.mesh_matrix is not None:
             mesh_min = min([min(x) for x in self.mesh_matrix])
@@ -1449,176 +1701,27 @@ class ZMesh:
             return round(avg_z, 2)
         else:
             return 0.
-    def _get_linear_index(self, coord, axis):
-        if axis == 0:
-            # X-axis
-            mesh_min = self.mesh_x_min
-            mesh_cnt = self.mesh_x_count
-            mesh_dist = self.mesh_x_dist
-            cfunc = self.get_x_coordinate
-        else:
-            # Y-axis
-            mesh_min = self.mesh_y_min
-            mesh_cnt = self.mesh_y_count
-            mesh_dist = self.mesh_y_dist
-            cfunc = self.get_y_coordinate
-        t = 0.
-        idx = int(math.floor((coord - mesh_min) / mesh_dist))
-        idx = constrain(idx, 0, mesh_cnt - 2)
-        t = (coord - cfunc(idx)) / mesh_dist
-        return constrain(t, 0., 1.), idx
     def _sample_direct(self, z_matrix):
         self.mesh_matrix = z_matrix
     def _sample_lagrange(self, z_matrix):
-        x_mult = self.x_mult
-        y_mult = self.y_mult
-        self.mesh_matrix = \
-            [[0. if ((i % x_mult) or (j % y_mult))
-             else z_matrix[j//y_mult][i//x_mult]
-             for i in range(self.mesh_x_count)]
-             for j in range(self.mesh_y_count)]
-        xpts, ypts = self._get_lagrange_coords()
-        # Interpolate X coordinates
-        for i in range(self.mesh_y_count):
-            # only interpolate X-rows that have probed coordinates
-            if i % y_mult != 0:
-                continue
-            for j in range(self.mesh_x_count):
-                if j % x_mult == 0:
-                    continue
-                x = self.get_x_coordinate(j)
-                self.mesh_matrix[i][j] = self._calc_lagrange(xpts, x, i, 0)
-        # Interpolate Y coordinates
-        for i in range(self.mesh_x_count):
-            for j in range(self.mesh_y_count):
-                if j % y_mult == 0:
-                    continue
-                y = self.get_y_coordinate(j)
-                self.mesh_matrix[j][i] = self._calc_lagrange(ypts, y, i, 1)
-    def _get_lagrange_coords(self):
-        xpts = []
-        ypts = []
-        for i in range(self.mesh_params['x_count']):
-            xpts.append(self.get_x_coordinate(i * self.x_mult))
-        for j in range(self.mesh_params['y_count']):
-            ypts.append(self.get_y_coordinate(j * self.y_mult))
-        return xpts, ypts
-    def _calc_lagrange(self, lpts, c, vec, axis=0):
-        pt_cnt = len(lpts)
-        total = 0.
-        for i in range(pt_cnt):
-            n = 1.
-            d = 1.
-            for j in range(pt_cnt):
-                if j == i:
-                    continue
-                n *= (c - lpts[j])
-                d *= (lpts[i] - lpts[j])
-            if axis == 0:
-                # Calc X-Axis
-                z = self.mesh_matrix[vec][i*self.x_mult]
-            else:
-                # Calc Y-Axis
-                z = self.mesh_matrix[i*self.y_mult][vec]
-            total += z * n / d
-        return total
+        self._upsample(z_matrix, bicubic=False)
     def _sample_bicubic(self, z_matrix):
         # should work for any number of probe points above 3x3
-        x_mult = self.x_mult
-        y_mult = self.y_mult
-        c = self.mesh_params['tension']
-        self.mesh_matrix = \
-            [[0. if ((i % x_mult) or (j % y_mult))
-             else z_matrix[j//y_mult][i//x_mult]
-             for i in range(self.mesh_x_count)]
-             for j in range(self.mesh_y_count)]
-        # Interpolate X values
-        for y in range(self.mesh_y_count):
-            if y % y_mult != 0:
-                continue
-            for x in range(self.mesh_x_count):
-                if x % x_mult == 0:
-                    continue
-                pts = self._get_x_ctl_pts(x, y)
-                self.mesh_matrix[y][x] = self._cardinal_spline(pts, c)
-        # Interpolate Y values
-        for x in range(self.mesh_x_count):
-            for y in range(self.mesh_y_count):
-                if y % y_mult == 0:
-                    continue
-                pts = self._get_y_ctl_pts(x, y)
-                self.mesh_matrix[y][x] = self._cardinal_spline(pts, c)
-    def _get_x_ctl_pts(self, x, y):
-        # Fetch control points and t for a X value in the mesh
-        x_mult = self.x_mult
-        x_row = self.mesh_matrix[y]
-        last_pt = self.mesh_x_count - 1 - x_mult
-        if x < x_mult:
-            p0 = p1 = x_row[0]
-            p2 = x_row[x_mult]
-            p3 = x_row[2*x_mult]
-            t = x / float(x_mult)
-        elif x > last_pt:
-            p0 = x_row[last_pt - x_mult]
-            p1 = x_row[last_pt]
-            p2 = p3 = x_row[last_pt + x_mult]
-            t = (x - last_pt) / float(x_mult)
-        else:
-            found = False
-            for i in range(x_mult, last_pt, x_mult):
-                if x > i and x < (i + x_mult):
-                    p0 = x_row[i - x_mult]
-                    p1 = x_row[i]
-                    p2 = x_row[i + x_mult]
-                    p3 = x_row[i + 2*x_mult]
-                    t = (x - i) / float(x_mult)
-                    found = True
-                    break
-            if not found:
-                raise BedMeshError(
-                    "bed_mesh: Error finding x control points")
-        return p0, p1, p2, p3, t
-    def _get_y_ctl_pts(self, x, y):
-        # Fetch control points and t for a Y value in the mesh
-        y_mult = self.y_mult
-        last_pt = self.mesh_y_count - 1 - y_mult
-        y_col = self.mesh_matrix
-        if y < y_mult:
-            p0 = p1 = y_col[0][x]
-            p2 = y_col[y_mult][x]
-            p3 = y_col[2*y_mult][x]
-            t = y / float(y_mult)
-        elif y > last_pt:
-            p0 = y_col[last_pt - y_mult][x]
-            p1 = y_col[last_pt][x]
-            p2 = p3 = y_col[last_pt + y_mult][x]
-            t = (y - last_pt) / float(y_mult)
-        else:
-            found = False
-            for i in range(y_mult, last_pt, y_mult):
-                if y > i and y < (i + y_mult):
-                    p0 = y_col[i - y_mult][x]
-                    p1 = y_col[i][x]
-                    p2 = y_col[i + y_mult][x]
-                    p3 = y_col[i + 2*y_mult][x]
-                    t = (y - i) / float(y_mult)
-                    found = True
-                    break
-            if not found:
-                raise BedMeshError(
-                    "bed_mesh: Error finding y control points")
-        return p0, p1, p2, p3, t
-    def _cardinal_spline(self, p, tension):
-        t = p[4]
-        t2 = t*t
-        t3 = t2*t
-        m1 = tension * (p[2] - p[0])
-        m2 = tension * (p[3] - p[1])
-        a = p[1] * (2*t3 - 3*t2 + 1)
-        b = p[2] * (-2*t3 + 3*t2)
-        c = m1 * (t3 - 2*t2 + t)
-        d = m2 * (t3 - t2)
-        return a + b + c + d
+        self._upsample(z_matrix, bicubic=True)
+    def _upsample(self, z_matrix, bicubic):
+        ffi_main, ffi_lib = chelper.get_ffi()
+        algo = ffi_lib.BM_ALGO_BICUBIC if bicubic else ffi_lib.BM_ALGO_LAGRANGE
+        x_cnt = self.mesh_x_count
+        y_cnt = self.mesh_y_count
+        zvals = ffi_main.new('double[]', x_cnt * y_cnt)
+        ret = ffi_lib.bed_mesh_upsample(
+            zvals, [z for line in z_matrix for z in line],
+            self.mesh_params['x_count'], self.mesh_params['y_count'],
+            self.x_mult, self.y_mult, algo, self.mesh_params['tension'])
+        if ret:
+            raise BedMeshError("bed_mesh: Error interpolating mesh")
+        self.mesh_matrix = [list(zvals[i:i+x_cnt])
+                            for i in range(0, x_cnt * y_cnt, x_cnt)]
 
 
 class ProfileManager:
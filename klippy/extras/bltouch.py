@@ -58,6 +58,7 @@ class BLTouchProbe:
         self.get_steppers = self.mcu_endstop.get_steppers
         self.home_wait = self.mcu_endstop.home_wait
         self.query_endstop = self.mcu_endstop.query_endstop
+        self.get_trigger_latency = self.mcu_endstop.get_trigger_latency
         # multi probes state
         self.multi = 'OFF'
         # Common probe implementation helpers
@@ -22,7 +22,7 @@ BATCH_INTERVAL = 0.500
 # Helper to process accumulated messages in periodic batches
 class BatchBulkHelper:
     def __init__(self, printer, batch_cb, start_cb=None, stop_cb=None,
-                 batch_interval=BATCH_INTERVAL):
+                 batch_interval=BATCH_INTERVAL, clients_changed_cb=None):
         self.printer = printer
         self.batch_cb = batch_cb
         if start_cb is None:
@@ -31,11 +31,15 @@ class BatchBulkHelper:
         if stop_cb is None:
             stop_cb = (lambda: None)
         self.stop_cb = stop_cb
+        if clients_changed_cb is None:
+            clients_changed_cb = (lambda: None)
+        self.clients_changed_cb = clients_changed_cb
         self.is_started = False
         self.batch_interval = batch_interval
         self.batch_timer = None
         self.client_cbs = []
         self.webhooks_start_resp = {}
+        self.webhooks_encode_cache = [None, {}]
     # Periodic batch processing
     def _start(self):
         if self.is_started:
@@ -76,6 +80,8 @@ class BatchBulkHelper:
             return self.printer.get_reactor().NEVER
         if not msg:
             return eventtime + self.batch_interval
+        reactor = self.printer.get_reactor()
+        clients_changed = False
         for client_cb in list(self.client_cbs):
             res = client_cb(msg)
             if not res:
@@ -83,15 +89,23 @@ class BatchBulkHelper:
                 self.client_cbs.remove(client_cb)
                 if not self.client_cbs:
                     self._stop()
-                    return self.printer.get_reactor().NEVER
+                    return reactor.NEVER
+                clients_changed = True
+        if clients_changed:
+            # Notify from outside of the batch timer
+            reactor.register_callback(self._note_clients_changed)
         return eventtime + self.batch_interval
     # Client registration
+    def _note_clients_changed(self, eventtime=None):
+        if self.is_started:
+            self.clients_changed_cb()
     def add_client(self, client_cb):
         self.client_cbs.append(client_cb)
         self._start()
+        self._note_clients_changed()
     # Webhooks registration
     def _add_api_client(self, web_request):
-        whbatch = BatchWebhooksClient(web_request)
+        whbatch = BatchWebhooksClient(web_request, self.webhooks_encode_cache)
         self.add_client(whbatch.handle_batch)
         web_request.send(self.webhooks_start_resp)
     def add_mux_endpoint(self, path, key, value, webhooks_start_resp):
@@ -101,15 +115,17 @@ class BatchBulkHelper:
 
 # A webhooks wrapper for use by BatchBulkHelper
 class BatchWebhooksClient:
-    def __init__(self, web_request):
+    def __init__(self, web_request, encode_cache):
         self.cconn = web_request.get_client_connection()
         self.template = web_request.get_dict('response_template', {})
+        # Encoded batch shared by all api clients ([msg, encodings])
+        self.encode_cache = encode_cache
     def handle_batch(self, msg):
         if self.cconn.is_closed():
             return False
-        tmp = dict(self.template)
-        tmp['params'] = msg
-        self.cconn.send(tmp)
+        if self.encode_cache[0] is not msg:
+            self.encode_cache[:] = [msg, {}]
+        self.cconn.send_with_params(self.template, msg, self.encode_cache[1])
         return True
 
 # Helper class to store incoming messages in a queue
@@ -4,29 +4,78 @@
 #
 # This file may be distributed under the terms of the GNU GPLv3 license.
 import traceback, logging, ast, copy, json
-import jinja2
+import jinja2, jinja2.meta, jinja2.nodes
 
 
 ######################################################################
 # Template handling
 ######################################################################
 
+# Status dictionary that records which fields a template accesses
+class TrackedStatus(dict):
+    def __init__(self, status, fields):
+        dict.__init__(self, status)
+        self._fields = fields
+    def _access_all(self):
+        # A None entry indicates the whole dictionary was accessed
+        self._fields.add(None)
+    def __getitem__(self, key):
+        self._fields.add(key)
+        return dict.__getitem__(self, key)
+    def get(self, key, default=None):
+        self._fields.add(key)
+        return dict.get(self, key, default)
+    def __contains__(self, key):
+        self._fields.add(key)
+        return dict.__contains__(self, key)
+    def __iter__(self):
+        self._access_all()
+        return dict.__iter__(self)
+    def __len__(self):
+        self._access_all()
+        return dict.__len__(self)
+    def __repr__(self):
+        self._access_all()
+        return dict.__repr__(self)
+    def keys(self):
+        self._access_all()
+        return dict.keys(self)
+    def values(self):
+        self._access_all()
+        return dict.values(self)
+    def items(self):
+        self._access_all()
+        return dict.items(self)
+
 # Wrapper for access to printer object get_status() methods
 class GetStatusWrapper:
-    def __init__(self, printer, eventtime=None):
+    def __init__(self, printer, eventtime=None, status_cache=None):
         self.printer = printer
         self.eventtime = eventtime
         self.cache = {}
+        if status_cache is None:
+            status_cache = {}
+        self.status_cache = status_cache
+        # Track accessed objects (for template memoization)
+        self.accessed = {}
+        self.accessed_all = False
     def __getitem__(self, val):
         sval = str(val).strip()
         if sval in self.cache:
             return self.cache[sval]
         po = self.printer.lookup_object(sval, None)
         if po is None or not hasattr(po, 'get_status'):
+            self.accessed[sval] = None
             raise KeyError(val)
         if self.eventtime is None:
             self.eventtime = self.printer.get_reactor().monotonic()
-        self.cache[sval] = res = copy.deepcopy(po.get_status(self.eventtime))
+        status = self.status_cache.get(sval)
+        if status is None:
+            status = copy.deepcopy(po.get_status(self.eventtime))
+            self.status_cache[sval] = status
+        fields = set()
+        self.accessed[sval] = (status, fields)
+        self.cache[sval] = res = TrackedStatus(status, fields)
         return res
     def __contains__(self, val):
         try:
@@ -35,9 +84,52 @@ class GetStatusWrapper:
             return False
         return True
     def __iter__(self):
+        self.accessed_all = True
         for name, obj in self.printer.lookup_objects():
             if self.__contains__(name):
                 yield name
+    def get_dependencies(self):
+        # Return the status fields used during a render (or None if
+        # they can not be determined)
+        if self.accessed_all:
+            return None
+        deps = {}
+        for name, access in self.accessed.items():
+            if access is not None:
+                status, fields = access
+                if None in fields:
+                    access = (status, None)
+                else:
+                    access = ({f: status.get(f, KeyError) for f in fields},
+                              fields)
+            deps[name] = access
+        return deps
+    def check_dependencies(self, deps):
+        # Check if the given status fields are unchanged
+        if self.eventtime is None:
+            self.eventtime = self.printer.get_reactor().monotonic()
+        for name, access in deps.items():
+            po = self.printer.lookup_object(name, None)
+            if po is None or not hasattr(po, 'get_status'):
+                if access is not None:
+                    return False
+                continue
+            if access is None:
+                return False
+            status, fields = access
+            cur_status = po.get_status(self.eventtime)
+            if fields is None:
+                if cur_status != status:
+                    return False
+                continue
+            for field in fields:
+                if cur_status.get(field, KeyError) != status[field]:
+                    return False
+        return True
+
+# Template context entries that prevent memoizing a render
+NON_DETERMINISTIC_FILTERS = ['random', 'tojson']
+NON_DETERMINISTIC_NAMES = ['lipsum']
 
 # Wrapper around a Jinja2 template
 class TemplateWrapper:
@@ -48,30 +140,95 @@ class TemplateWrapper:
         gcode_macro = self.printer.lookup_object('gcode_macro')
         self.create_template_context = gcode_macro.create_template_context
         try:
-            self.template = env.from_string(script)
+            compiled = gcode_macro.lookup_template(script)
+            if compiled is None:
+                compiled = (env.compile(script),
+                            self._get_memo_names(env.parse(script)))
+                gcode_macro.store_template(script, compiled)
+            code, self.context_names = compiled
+            self.template = env.template_class.from_code(
+                env, code, env.make_globals(None), None)
         except Exception as e:
             msg = "Error loading template '%s': %s" % (
                  name, traceback.format_exception_only(type(e), e)[-1])
             logging.exception(msg)
             raise printer.config_error(msg)
+        self.memo = None
+    def _get_memo_names(self, ast):
+        # Determine the context names a template uses (or None if the
+        # template output may not be reused)
+        names = jinja2.meta.find_undeclared_variables(ast)
+        if [n for n in names if n.startswith('action_')]:
+            return None
+        for f in ast.find_all(jinja2.nodes.Filter):
+            if f.name in NON_DETERMINISTIC_FILTERS:
+                return None
+        for n in ast.find_all(jinja2.nodes.Name):
+            if n.name in NON_DETERMINISTIC_NAMES:
+                return None
+        return sorted(names)
+    def _get_memo_key(self, context):
+        if self.context_names is None:
+            return None
+        printer = context.get('printer')
+        if not isinstance(printer, GetStatusWrapper):
+            return None
+        key = []
+        for name in self.context_names:
+            if name == 'printer':
+                continue
+            val = context.get(name)
+            if callable(val) or (isinstance(val, dict)
+                                 and [v for v in val.values() if callable(v)]):
+                return None
+            key.append((name, copy.deepcopy(val)))
+        return key
     def render(self, context=None):
         if context is None:
             context = self.create_template_context()
+        memo_key = self._get_memo_key(context)
+        if memo_key is not None and self.memo is not None:
+            prev_key, deps, result = self.memo
+            if (prev_key == memo_key
+                and context['printer'].check_dependencies(deps)):
+                return result
         try:
-            return str(self.template.render(context))
+            result = str(self.template.render(context))
         except Exception as e:
             msg = "Error evaluating '%s': %s" % (
                 self.name, traceback.format_exception_only(type(e), e)[-1])
             logging.exception(msg)
             raise self.gcode.error(msg)
+        if memo_key is not None:
+            deps = context['printer'].get_dependencies()
+            self.memo = None
+            if deps is not None:
+                self.memo = (memo_key, deps, result)
+        return result
     def run_gcode_from_command(self, context=None):
         self.gcode.run_script_from_command(self.render(context))
 
+# Compiled template code by source (kept across restarts).  Only the
+# code is shared - each Template is created with the current Environment.
+compiled_templates = {}
+
 # Main gcode macro template tracking
 class PrinterGCodeMacro:
     def __init__(self, config):
         self.printer = config.get_printer()
         self.env = jinja2.Environment('{%', '%}', '{', '}')
+        self.prev_templates = dict(compiled_templates)
+        compiled_templates.clear()
+        # Status snapshots shared by renders with the same eventtime
+        self.status_cache = {}
+        self.status_cache_time = None
+    def lookup_template(self, script):
+        compiled = self.prev_templates.get(script)
+        if compiled is not None:
+            compiled_templates[script] = compiled
+        return compiled
+    def store_template(self, script, compiled):
+        compiled_templates[script] = compiled
     def load_template(self, config, option, default=None):
         name = "%s:%s" % (config.get_name(), option)
         if default is None:
@@ -95,8 +252,14 @@ class PrinterGCodeMacro:
             logging.exception("Remote Call Error")
         return ""
     def create_template_context(self, eventtime=None):
+        status_cache = None
+        if eventtime is not None:
+            if eventtime != self.status_cache_time:
+                self.status_cache = {}
+                self.status_cache_time = eventtime
+            status_cache = self.status_cache
         return {
-            'printer': GetStatusWrapper(self.printer, eventtime),
+            'printer': GetStatusWrapper(self.printer, eventtime, status_cache),
             'action_emergency_stop': self._action_emergency_stop,
             'action_respond_info': self._action_respond_info,
             'action_raise_error': self._action_raise_error,
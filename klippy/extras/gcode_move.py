@@ -125,7 +125,7 @@ class GCodeMove:
     # G-Code movement commands
     def cmd_G1(self, gcmd):
         # Move
-        params = gcmd.get_command_parameters()
+        params = gcmd.get_command_values()
         if 'G' in params and 'X' in params and 'Y' in params and 'Z' in params:
             if self.v_sd.cmd_from_sd:
                 #commandline = gcmd.get_commandline()
@@ -142,7 +142,7 @@ class GCodeMove:
                 # if self.z_positon != "":    #for test
                 content = {
                     'commandline': gcmd.get_commandline(),
-                    'Z': params['Z'],                       #self.z_positon, 
+                    'Z': str(params['Z']),                  #self.z_positon, 
                     'extrude_type': 'M82' if self.absolute_extrude else 'M83',
                     'e_extrude_abs': 0 #self.Coord(*self.move_position)[3]
                 }
@@ -292,7 +292,7 @@ class GCodeMove:
         kinfo = zip("XYZ", kin.calc_position(dict(cinfo)))
         kin_pos = " ".join(["%s:%.6f" % (a, v) for a, v in kinfo])
         toolhead_pos = " ".join(["%s:%.6f" % (a, v) for a, v in zip(
-            "XYZE", toolhead.get_position())])
+            "XYZE", toolhead.get_physical_position())])
         gcode_pos = " ".join(["%s:%.6f"  % (a, v)
                               for a, v in zip("XYZE", self.last_position)])
         base_pos = " ".join(["%s:%.6f"  % (a, v)
@@ -4,6 +4,7 @@
 #
 # This file may be distributed under the terms of the GNU GPLv3 license.
 import os, logging, threading
+import chelper
 
 
 ######################################################################
@@ -15,6 +16,14 @@ MAX_HEAT_TIME = 5.0
 AMBIENT_TEMP = 25.
 PID_PARAM_BASE = 255.
 
+# Options that PID_CALIBRATE and MPC_CALIBRATE store with SAVE_CONFIG
+CONTROL_OPTIONS = {
+    'pid': ['pid_Kp', 'pid_Ki', 'pid_Kd'],
+    'mpc': ['heater_power', 'mpc_block_heat_capacity',
+            'mpc_sensor_responsiveness', 'mpc_ambient_transfer',
+            'mpc_fan_ambient_transfer', 'mpc_cooling_fan'],
+}
+
 class Heater:
     def __init__(self, config, sensor):
         self.printer = config.get_printer()
@@ -41,13 +50,26 @@ class Heater:
         self.lock = threading.Lock()
         self.last_temp = self.smoothed_temp = self.target_temp = 0.
         self.last_temp_time = 0.
+        # Status change reporting (for webhooks subscriptions)
+        webhooks = self.printer.lookup_object('webhooks')
+        notifier = webhooks.register_status_notifier(
+            self.name, ['temperature', 'target', 'power', 'can_extrude'])
+        self.note_status_change = notifier.note_change
+        self.last_status = (None, None, None)
         # pwm caching
         self.next_pwm_time = 0.
         self.last_pwm_value = 0.
         # Setup control algorithm sub-class
-        algos = {'watermark': ControlBangBang, 'pid': ControlPID}
+        algos = {'watermark': ControlBangBang, 'pid': ControlPID,
+                 'mpc': ControlMPC}
         algo = config.getchoice('control', algos)
         self.control = algo(self, config)
+        # The calibrated settings of another control algorithm remain in
+        # the config after SAVE_CONFIG switches the control type
+        for name, options in CONTROL_OPTIONS.items():
+            if algos[name] is not algo:
+                for option in options:
+                    config.get(option, None)
         # Setup output heater pin
         heater_pin = config.get('heater_pin')
         ppins = self.printer.lookup_object('pins')
@@ -59,6 +81,7 @@ class Heater:
         # Load additional modules
         self.printer.load_object(config, "verify_heater %s" % (short_name,))
         self.printer.load_object(config, "pid_calibrate")
+        self.printer.load_object(config, "mpc_calibrate")
         gcode = self.printer.lookup_object("gcode")
         gcode.register_mux_command("SET_HEATER_TEMPERATURE", "HEATER",
                                    short_name, self.cmd_SET_HEATER_TEMPERATURE,
@@ -89,6 +112,15 @@ class Heater:
             adj_time = min(time_diff * self.inv_smooth_time, 1.)
             self.smoothed_temp += temp_diff * adj_time
             self.can_extrude = (self.smoothed_temp >= self.min_extrude_temp)
+            status = (round(self.smoothed_temp, 2), self.last_pwm_value,
+                      self.can_extrude)
+            last_status = self.last_status
+            if status != last_status:
+                self.last_status = status
+                self.note_status_change([
+                    field for field, new, old in zip(
+                        ('temperature', 'power', 'can_extrude'), status,
+                        last_status) if new != old])
         #logging.debug("temp: %.3f %f = %f", read_time, temp)
     def _handle_shutdown(self):
         self.is_shutdown = True
@@ -108,6 +140,7 @@ class Heater:
                 % (degrees, self.min_temp, self.max_temp))
         with self.lock:
             self.target_temp = degrees
+        self.note_status_change(('target',))
     def get_temp(self, eventtime):
         print_time = self.mcu_pwm.get_mcu().estimated_print_time(eventtime) - 5.
         with self.lock:
@@ -123,11 +156,13 @@ class Heater:
             old_control = self.control
             self.control = control
             self.target_temp = 0.
+        self.note_status_change(('target',))
         return old_control
     def alter_target(self, target_temp):
         if target_temp:
             target_temp = max(self.min_temp, min(self.max_temp, target_temp))
         self.target_temp = target_temp
+        self.note_status_change(('target',))
     def stats(self, eventtime):
         with self.lock:
             target_temp = self.target_temp
@@ -226,6 +261,179 @@ class ControlPID:
                 or abs(self.prev_temp_deriv) > PID_SETTLE_SLOPE)
 
 
+######################################################################
+# Model predictive control (MPC) algo
+######################################################################
+
+MPC_AMBIENT_GAIN = .1
+MPC_LOAD_UPDATE_TIME = .250
+MPC_FLOW_LOOKAHEAD = 1.
+MPC_FLOW_MOVES = 64
+
+def read_mpc_profile(config):
+    return {
+        'heater_power': config.getfloat('heater_power', above=0.),
+        'block_heat_capacity': config.getfloat('mpc_block_heat_capacity',
+                                               above=0.),
+        'sensor_responsiveness': config.getfloat(
+            'mpc_sensor_responsiveness', above=0.),
+        'ambient_transfer': config.getfloat('mpc_ambient_transfer',
+                                            above=0.),
+        'fan_ambient_transfer': config.getfloat('mpc_fan_ambient_transfer',
+                                                0., minval=0.),
+        'filament_heat_capacity': config.getfloat(
+            'mpc_filament_heat_capacity', 0.0022, minval=0.),
+        'target_reach_time': config.getfloat('mpc_target_reach_time', 2.,
+                                             above=0.),
+        'smoothing': config.getfloat('mpc_smoothing', .5, above=0.,
+                                     maxval=1.)}
+
+# Thermal model of a heater block with a lagging temperature sensor.
+# The block receives the heater power and loses heat to the ambient
+# air (the loss increases with part cooling fan speed and with the
+# flow of cold filament through the block).
+class MPCModel:
+    def __init__(self, profile, temp, ambient_temp):
+        self.heater_power = profile['heater_power']
+        self.heat_capacity = profile['block_heat_capacity']
+        self.responsiveness = profile['sensor_responsiveness']
+        self.smoothing = profile['smoothing']
+        self.block_temp = self.sensor_temp = temp
+        self.ambient_temp = ambient_temp
+    def update(self, temp, time_diff, power, loss_coeff):
+        if time_diff <= 0.:
+            return
+        # Predict the block and sensor temperatures
+        loss = loss_coeff * (self.block_temp - self.ambient_temp)
+        self.block_temp += (power - loss) * time_diff / self.heat_capacity
+        resp = min(1., self.responsiveness * time_diff)
+        self.sensor_temp += (self.block_temp - self.sensor_temp) * resp
+        # Correct the model towards the measured temperature
+        adj = 1. - (1. - self.smoothing)**time_diff
+        temp_err = temp - self.sensor_temp
+        self.sensor_temp += temp_err * adj
+        self.block_temp += temp_err * adj
+        # Treat the remaining model error as a change in the ambient
+        # temperature (this compensates for unmodeled heat losses)
+        if power:
+            energy_err = temp_err * adj * self.heat_capacity
+            self.ambient_temp += (MPC_AMBIENT_GAIN * energy_err
+                                  / (loss_coeff * time_diff))
+        else:
+            # An unpowered block does not cool below the ambient temperature
+            self.ambient_temp = min(self.ambient_temp, temp)
+    def calc_power(self, target_temp, loss_coeff, reach_time):
+        # Feed-forward the heat losses at the target plus the power
+        # needed to bring the block to the target temperature
+        loss = loss_coeff * (target_temp - self.ambient_temp)
+        heat = (target_temp - self.block_temp) * self.heat_capacity
+        return loss + heat / reach_time
+
+class ControlMPC:
+    def __init__(self, heater, config):
+        self.heater = heater
+        self.printer = config.get_printer()
+        self.heater_max_power = heater.get_max_power()
+        self.profile = read_mpc_profile(config)
+        self.cooling_fan_name = config.get('mpc_cooling_fan', None)
+        self.min_deriv_time = heater.get_smooth_time()
+        self.model = None
+        self.prev_temp = AMBIENT_TEMP
+        self.prev_temp_time = 0.
+        self.prev_temp_deriv = 0.
+        self.last_power = 0.
+        # Heater load (updated from the main thread)
+        self.mcu = self.cooling_fan = self.extruder = None
+        self.fan_speed = self.flow_rate = 0.
+        self.printer.register_event_handler("klippy:connect",
+                                            self._handle_connect)
+        self.printer.register_event_handler("klippy:ready",
+                                            self._handle_ready)
+    def get_profile(self):
+        return dict(self.profile)
+    def _handle_connect(self):
+        self.mcu = self.printer.lookup_object('mcu')
+        if self.cooling_fan_name is not None:
+            self.cooling_fan = self.printer.lookup_object(
+                self.cooling_fan_name)
+        obj = self.printer.lookup_object(self.heater.get_name(), None)
+        if hasattr(obj, 'get_trapq') and hasattr(obj, 'filament_area'):
+            self.extruder = obj
+    def _handle_ready(self):
+        if self.cooling_fan is None and self.extruder is None:
+            return
+        reactor = self.printer.get_reactor()
+        reactor.register_timer(self._update_load, reactor.NOW)
+    def _calc_flow_rate(self, print_time):
+        # Average filament flow over the moves about to be extruded
+        ffi_main, ffi_lib = chelper.get_ffi()
+        data = ffi_main.new('struct pull_move[%d]' % (MPC_FLOW_MOVES,))
+        end_time = print_time + MPC_FLOW_LOOKAHEAD
+        count = ffi_lib.trapq_extract_old(self.extruder.get_trapq(), data,
+                                          MPC_FLOW_MOVES, print_time, end_time)
+        if not count:
+            return 0.
+        # Only flushed moves are in the history (newest first) - average
+        # over the time that the extracted moves cover
+        end_time = min(end_time, data[0].print_time + data[0].move_t)
+        dist = 0.
+        for move in data[0:count]:
+            t1 = max(0., print_time - move.print_time)
+            t2 = min(move.move_t, end_time - move.print_time)
+            dist += max(0., ((move.start_v + .5 * move.accel * (t1 + t2))
+                             * (t2 - t1) * move.x_r))
+        # Only the newest moves are extracted if the window has many moves
+        if count == MPC_FLOW_MOVES:
+            print_time = max(print_time, data[count-1].print_time)
+        return dist / (end_time - print_time) * self.extruder.filament_area
+    def _update_load(self, eventtime):
+        if self.cooling_fan is not None:
+            self.fan_speed = self.cooling_fan.get_status(eventtime)['speed']
+        if self.extruder is not None:
+            print_time = self.mcu.estimated_print_time(eventtime)
+            self.flow_rate = self._calc_flow_rate(print_time)
+        return eventtime + MPC_LOAD_UPDATE_TIME
+    def _calc_loss_coeff(self):
+        profile = self.profile
+        return (profile['ambient_transfer']
+                + profile['fan_ambient_transfer'] * self.fan_speed
+                + profile['filament_heat_capacity'] * self.flow_rate)
+    def temperature_update(self, read_time, temp, target_temp):
+        time_diff = read_time - self.prev_temp_time
+        # Calculate change of temperature
+        temp_diff = temp - self.prev_temp
+        if time_diff >= self.min_deriv_time:
+            temp_deriv = temp_diff / time_diff
+        else:
+            temp_deriv = (self.prev_temp_deriv * (self.min_deriv_time-time_diff)
+                          + temp_diff) / self.min_deriv_time
+        # Update the thermal model
+        loss_coeff = self._calc_loss_coeff()
+        if self.model is None:
+            self.model = MPCModel(self.profile, temp, min(temp, AMBIENT_TEMP))
+        else:
+            self.model.update(temp, min(time_diff, MAX_HEAT_TIME),
+                              self.last_power, loss_coeff)
+        # Calculate output
+        heater_power = self.profile['heater_power']
+        co = 0.
+        if target_temp:
+            power = self.model.calc_power(target_temp, loss_coeff,
+                                          self.profile['target_reach_time'])
+            co = power / heater_power
+        bounded_co = max(0., min(self.heater_max_power, co))
+        self.heater.set_pwm(read_time, bounded_co)
+        # Store state for next measurement
+        self.last_power = bounded_co * heater_power
+        self.prev_temp = temp
+        self.prev_temp_time = read_time
+        self.prev_temp_deriv = temp_deriv
+    def check_busy(self, eventtime, smoothed_temp, target_temp):
+        temp_diff = target_temp - smoothed_temp
+        return (abs(temp_diff) > PID_SETTLE_DELTA
+                or abs(self.prev_temp_deriv) > PID_SETTLE_SLOPE)
+
+
 ######################################################################
 # Sensor and heater lookup
 ######################################################################
@@ -250,6 +458,8 @@ class PrinterHeaters:
         gcode.register_command("M105", self.cmd_M105, when_not_ready=True)
         gcode.register_command("TEMPERATURE_WAIT", self.cmd_TEMPERATURE_WAIT,
                                desc=self.cmd_TEMPERATURE_WAIT_help)
+        gcode.register_command("WAIT_FOR_HEATERS", self.cmd_WAIT_FOR_HEATERS,
+                               desc=self.cmd_WAIT_FOR_HEATERS_help)
     def load_config(self, config):
         self.have_load_sensors = True
         # Load default temperature sensors
@@ -334,14 +544,22 @@ class PrinterHeaters:
         if not did_ack:
             gcmd.respond_raw(msg)
     def _wait_for_temperature(self, heater):
-        # Helper to wait on heater.check_busy() and report M105 temperatures
+        self.wait_for_heaters([heater])
+    def wait_for_heaters(self, heaters):
+        # Helper to wait on heater.check_busy() of several heaters at
+        # once and report M105 temperatures.  Heaters without a target
+        # temperature are not waited on.
         if self.printer.get_start_args().get('debugoutput') is not None:
             return
         toolhead = self.printer.lookup_object("toolhead")
         gcode = self.printer.lookup_object("gcode")
         reactor = self.printer.get_reactor()
         eventtime = reactor.monotonic()
-        while not self.printer.is_shutdown() and heater.check_busy(eventtime):
+        while not self.printer.is_shutdown():
+            busy = [h for h in heaters
+                    if h.get_temp(eventtime)[1] and h.check_busy(eventtime)]
+            if not busy:
+                break
             print_time = toolhead.get_last_move_time()
             gcode.respond_raw(self._get_temp(eventtime))
             eventtime = reactor.pause(eventtime + 1.)
@@ -351,6 +569,21 @@ class PrinterHeaters:
         heater.set_temp(temp)
         if wait and temp:
             self._wait_for_temperature(heater)
+    cmd_WAIT_FOR_HEATERS_help = "Wait for heaters to reach their targets"
+    def cmd_WAIT_FOR_HEATERS(self, gcmd):
+        heater_names = gcmd.get('HEATERS', None)
+        if heater_names is None:
+            heaters = list(self.heaters.values())
+        else:
+            heaters = []
+            for name in heater_names.split(','):
+                name = name.strip()
+                if name not in self.heaters:
+                    raise gcmd.error("Unknown heater '%s'" % (name,))
+                heaters.append(self.heaters[name])
+        toolhead = self.printer.lookup_object('toolhead')
+        toolhead.register_lookahead_callback((lambda pt: None))
+        self.wait_for_heaters(heaters)
     cmd_TEMPERATURE_WAIT_help = "Wait for a temperature on a sensor"
     def cmd_TEMPERATURE_WAIT(self, gcmd):
         sensor_name = gcmd.get('SENSOR')
@@ -65,6 +65,20 @@ class HomingMove:
         if max_steps <= 0.:
             return .001
         return move_t / max_steps
+    def _note_trigger_latency(self, trigger_times):
+        # Report the delay between the trigger and the stepper stop on
+        # each mcu involved in the move
+        for mcu_endstop, name in self.endstops:
+            if name not in trigger_times:
+                continue
+            get_latency = getattr(mcu_endstop, 'get_trigger_latency', None)
+            latency = get_latency() if get_latency is not None else {}
+            if len(latency) < 2:
+                continue
+            msg = ["%s=%.6f" % (n, lt) for n, lt in sorted(latency.items())]
+            logging.info("Trigger latency on %s: %s", name, ", ".join(msg))
+            phoming = self.printer.lookup_object('homing')
+            phoming.note_trigger_latency(name, latency)
     def calc_toolhead_pos(self, kin_spos, offsets):
         kin_spos = dict(kin_spos)
         kin = self.toolhead.get_kinematics()
@@ -117,6 +131,7 @@ class HomingMove:
             elif check_triggered and error is None:
                 self.gcode.run_script_from_command(f'M117 Tip code: 101 {name}')
                 error = "No trigger on %s after full movement" % (name,)
+        self._note_trigger_latency(trigger_times)
         # Determine stepper halt positions
         self.toolhead.flush_step_generation()
         for sp in self.stepper_positions:
@@ -152,6 +167,66 @@ class HomingMove:
         if error is not None:
             raise self.printer.command_error(error)
         return trigpos
+    def tap_move(self, moves, tap_count, hold_time):
+        # Notify start of probing move
+        self.printer.send_event("homing:homing_move_begin", self)
+        # Note start location
+        self.toolhead.flush_step_generation()
+        kin = self.toolhead.get_kinematics()
+        kin_spos = {s.get_name(): s.get_commanded_position()
+                    for s in kin.get_steppers()}
+        self.stepper_positions = [ StepperPosition(s, name)
+                                   for es, name in self.endstops
+                                   for s in es.get_steppers() ]
+        # Start recording taps
+        print_time = self.toolhead.get_last_move_time()
+        endstop_triggers = []
+        for mcu_endstop, name in self.endstops:
+            rest_time = self._calc_endstop_rate(mcu_endstop, *moves[0])
+            wait = mcu_endstop.tap_start(print_time, ENDSTOP_SAMPLE_TIME,
+                                         ENDSTOP_SAMPLE_COUNT, rest_time,
+                                         tap_count, hold_time)
+            endstop_triggers.append(wait)
+        all_endstop_trigger = multi_complete(self.printer, endstop_triggers)
+        self.toolhead.dwell(HOMING_START_DELAY)
+        # Issue all the moves - they only stop early on an error
+        error = None
+        try:
+            self.toolhead.drip_moves(moves, all_endstop_trigger)
+        except self.printer.command_error as e:
+            error = "Error during probing move: %s" % (str(e),)
+        move_end_print_time = self.toolhead.get_last_move_time()
+        tap_times = []
+        for mcu_endstop, name in self.endstops:
+            try:
+                tap_times = mcu_endstop.tap_wait(move_end_print_time)
+            except self.printer.command_error as e:
+                if error is None:
+                    error = "Error during probing %s: %s" % (name, str(e))
+        # Determine the toolhead position at each tap
+        self.toolhead.flush_step_generation()
+        for sp in self.stepper_positions:
+            sp.note_home_end(move_end_print_time)
+        halt_steps = {sp.stepper_name: sp.halt_pos - sp.start_pos
+                      for sp in self.stepper_positions}
+        tap_positions = []
+        for tap_time in tap_times:
+            tap_steps = {
+                sp.stepper_name: (sp.stepper.get_past_mcu_position(tap_time)
+                                  - sp.start_pos)
+                for sp in self.stepper_positions}
+            tap_positions.append(self.calc_toolhead_pos(kin_spos, tap_steps))
+        self.toolhead.set_position(self.calc_toolhead_pos(kin_spos,
+                                                          halt_steps))
+        # Signal probing move complete
+        try:
+            self.printer.send_event("homing:homing_move_end", self)
+        except self.printer.command_error as e:
+            if error is None:
+                error = str(e)
+        if error is not None:
+            raise self.printer.command_error(error)
+        return tap_positions
     def check_no_movement(self):
         if self.printer.get_start_args().get('debuginput') is not None:
             return None
@@ -242,9 +317,14 @@ class Homing:
 class PrinterHoming:
     def __init__(self, config):
         self.printer = config.get_printer()
+        self.trigger_latency = {}
         # Register g-code commands
         self.gcode = self.printer.lookup_object('gcode')
         self.gcode.register_command('G28', self.cmd_G28)
+    def note_trigger_latency(self, endstop_name, latency):
+        self.trigger_latency[endstop_name] = latency
+    def get_status(self, eventtime):
+        return {'trigger_latency': dict(self.trigger_latency)}
     def manual_home(self, toolhead, endstops, pos, speed,
                     triggered, check_triggered):
         hmove = HomingMove(self.printer, endstops, toolhead)
@@ -271,6 +351,15 @@ class PrinterHoming:
             raise self.printer.command_error(
                 "Probe triggered prior to movement")
         return epos
+    def tap_probing_move(self, mcu_probe, moves, tap_count, hold_time):
+        hmove = HomingMove(self.printer, [(mcu_probe, 'probe')])
+        try:
+            return hmove.tap_move(moves, tap_count, hold_time)
+        except self.printer.command_error:
+            if self.printer.is_shutdown():
+                raise self.printer.command_error(
+                    "Probing failed due to printer shutdown")
+            raise
     def cmd_G28(self, gcmd):
         # Move to origin
         axes = []
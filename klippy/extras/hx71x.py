@@ -57,6 +57,7 @@ class HX71xBase:
         self.batch_bulk.add_mux_endpoint(dump_path, "sensor", self.name, hdr)
         # Command Configuration
         self.query_hx71x_cmd = None
+        self.setup_home_cmd = self.query_home_state_cmd = None
         mcu.add_config_cmd(
             "config_hx71x oid=%d gain_channel=%d dout_pin=%s sclk_pin=%s"
             % (self.oid, self.gain_channel, self.dout_pin, self.sclk_pin))
@@ -71,6 +72,14 @@ class HX71xBase:
         self.ffreader.setup_query_command("query_hx71x_status oid=%c",
                                           oid=self.oid,
                                           cq=self.mcu.alloc_command_queue())
+        self.setup_home_cmd = self.mcu.lookup_command(
+            "hx71x_setup_home oid=%c clock=%u trigger_force=%u"
+            " trigger_slope=%u tare_samples=%c filter_shift=%c"
+            " trsync_oid=%c trigger_reason=%c error_reason=%c")
+        self.query_home_state_cmd = self.mcu.lookup_query_command(
+            "query_hx71x_home_state oid=%c",
+            "hx71x_home_state oid=%c homing=%c trigger_clock=%u tare=%i",
+            oid=self.oid)
 
     def get_mcu(self):
         return self.mcu
@@ -87,6 +96,23 @@ class HX71xBase:
     def add_client(self, callback):
         self.batch_bulk.add_client(callback)
 
+    # Homing (force thresholds are in raw sensor counts)
+    def setup_home(self, print_time, trigger_force, trigger_slope,
+                   tare_samples, filter_shift,
+                   trsync_oid, hit_reason, err_reason):
+        clock = self.mcu.print_time_to_clock(print_time)
+        self.setup_home_cmd.send(
+            [self.oid, clock, int(trigger_force), int(trigger_slope),
+             tare_samples, filter_shift, trsync_oid, hit_reason, err_reason])
+
+    def clear_home(self):
+        self.setup_home_cmd.send([self.oid, 0, 0, 0, 0, 0, 0, 0, 0])
+        if self.mcu.is_fileoutput():
+            return 0.
+        params = self.query_home_state_cmd.send([self.oid])
+        tclock = self.mcu.clock32_to_clock64(params['trigger_clock'])
+        return self.mcu.clock_to_print_time(tclock)
+
     # Measurement decoding
     def _convert_samples(self, samples):
         adc_factor = 1. / (1 << 23)
@@ -21,31 +21,85 @@ class InputShaperParams:
                                              shaper_defs.DEFAULT_DAMPING_RATIO,
                                              minval=0., maxval=1.)
         self.shaper_freq = config.getfloat('shaper_freq_' + axis, 0., minval=0.)
+        # Optional grid of shaper frequencies across the bed
+        self.freq_map = None
+        freq_map = config.getlists('shaper_freq_map_' + axis, None,
+                                   seps=(',', '\n'), parser=float)
+        map_min = config.getfloatlist('shaper_map_min', None, count=2)
+        map_max = config.getfloatlist('shaper_map_max', None, count=2)
+        if freq_map:
+            if map_min is None or map_max is None:
+                raise config.error("Options 'shaper_map_min' and"
+                                   " 'shaper_map_max' must be specified"
+                                   " in section '%s'" % (config.get_name(),))
+            try:
+                self.set_freq_map(freq_map, map_min, map_max)
+            except ValueError as e:
+                raise config.error("Option 'shaper_freq_map_%s' in section"
+                                   " '%s': %s" % (axis, config.get_name(),
+                                                  str(e)))
+        self.map_enabled = self.freq_map is not None
+    def set_freq_map(self, freq_map, map_min, map_max):
+        # The map is a list of rows (one per y coordinate)
+        x_count = len(freq_map[0])
+        if any([len(row) != x_count for row in freq_map]):
+            raise ValueError("all rows must have the same length")
+        if min([min(row) for row in freq_map]) <= 0.:
+            raise ValueError("frequencies must be positive")
+        if map_max[0] < map_min[0] or map_max[1] < map_min[1]:
+            raise ValueError("invalid map boundaries")
+        self.freq_map = ([list(row) for row in freq_map],
+                         tuple(map_min), tuple(map_max))
+        self.map_enabled = True
+    def get_freq_map(self):
+        if not self.map_enabled:
+            return None
+        return self.freq_map
     def update(self, gcmd):
         axis = self.axis.upper()
         self.damping_ratio = gcmd.get_float('DAMPING_RATIO_' + axis,
                                             self.damping_ratio,
                                             minval=0., maxval=1.)
-        self.shaper_freq = gcmd.get_float('SHAPER_FREQ_' + axis,
-                                          self.shaper_freq, minval=0.)
+        shaper_freq = gcmd.get_float('SHAPER_FREQ_' + axis, None, minval=0.)
+        if shaper_freq is not None:
+            # An explicit frequency replaces the frequency map
+            self.shaper_freq = shaper_freq
+            self.map_enabled = False
+        if self.freq_map is not None:
+            self.map_enabled = gcmd.get_int('SHAPER_MAP_' + axis,
+                                            self.map_enabled,
+                                            minval=0, maxval=1) == 1
         shaper_type = gcmd.get('SHAPER_TYPE', None)
         if shaper_type is None:
             shaper_type = gcmd.get('SHAPER_TYPE_' + axis, self.shaper_type)
         if shaper_type.lower() not in self.shapers:
             raise gcmd.error('Unsupported shaper type: %s' % (shaper_type,))
         self.shaper_type = shaper_type.lower()
+    def get_shaper_freq(self):
+        freq_map = self.get_freq_map()
+        if freq_map is not None:
+            # Pulses are scaled to the local frequency during step generation
+            return min([min(row) for row in freq_map[0]])
+        return self.shaper_freq
     def get_shaper(self):
-        if not self.shaper_freq:
+        shaper_freq = self.get_shaper_freq()
+        if not shaper_freq:
             A, T = shaper_defs.get_none_shaper()
         else:
             A, T = self.shapers[self.shaper_type](
-                    self.shaper_freq, self.damping_ratio)
+                    shaper_freq, self.damping_ratio)
         return len(A), A, T
     def get_status(self):
-        return collections.OrderedDict([
+        status = collections.OrderedDict([
             ('shaper_type', self.shaper_type),
             ('shaper_freq', '%.3f' % (self.shaper_freq,)),
             ('damping_ratio', '%.6f' % (self.damping_ratio,))])
+        freq_map = self.get_freq_map()
+        if freq_map is not None:
+            freqs = [f for row in freq_map[0] for f in row]
+            status['shaper_freq_map'] = '%.3f-%.3f' % (min(freqs),
+                                                       max(freqs))
+        return status
 
 class AxisInputShaper:
     def __init__(self, axis, config):
@@ -53,6 +107,7 @@ class AxisInputShaper:
         self.params = InputShaperParams(axis, config)
         self.n, self.A, self.T = self.params.get_shaper()
         self.saved = None
+        self.freq_map = self.c_freq_map = None
     def get_name(self):
         return 'shaper_' + self.axis
     def get_shaper(self):
@@ -60,14 +115,40 @@ class AxisInputShaper:
     def update(self, gcmd):
         self.params.update(gcmd)
         self.n, self.A, self.T = self.params.get_shaper()
+    def set_freq_map(self, freq_map, map_min, map_max):
+        self.params.set_freq_map(freq_map, map_min, map_max)
+        self.n, self.A, self.T = self.params.get_shaper()
+    def _get_c_freq_map(self):
+        freq_map = self.params.get_freq_map()
+        if freq_map is None:
+            return None
+        if freq_map is not self.freq_map:
+            ffi_main, ffi_lib = chelper.get_ffi()
+            rows, map_min, map_max = freq_map
+            c_freq_map = ffi_main.gc(ffi_lib.shaper_freq_map_alloc(),
+                                     ffi_lib.shaper_freq_map_free)
+            freqs = [f for row in rows for f in row]
+            ret = ffi_lib.shaper_freq_map_set(
+                c_freq_map, len(rows[0]), len(rows), freqs,
+                map_min[0], map_min[1], map_max[0], map_max[1], min(freqs))
+            if ret:
+                return None
+            self.freq_map, self.c_freq_map = freq_map, c_freq_map
+        return self.c_freq_map
     def set_shaper_kinematics(self, sk):
         ffi_main, ffi_lib = chelper.get_ffi()
+        axis = self.axis.encode()
+        c_freq_map = ffi_main.NULL
+        if self.n:
+            c_freq_map = self._get_c_freq_map() or ffi_main.NULL
+        ffi_lib.input_shaper_set_freq_map(sk, axis, c_freq_map)
         success = ffi_lib.input_shaper_set_shaper_params(
-                sk, self.axis.encode(), self.n, self.A, self.T) == 0
+                sk, axis, self.n, self.A, self.T) == 0
         if not success:
             self.disable_shaping()
+            ffi_lib.input_shaper_set_freq_map(sk, axis, ffi_main.NULL)
             ffi_lib.input_shaper_set_shaper_params(
-                    sk, self.axis.encode(), self.n, self.A, self.T)
+                    sk, axis, self.n, self.A, self.T)
         return success
     def disable_shaping(self):
         if self.saved is None and self.n:
@@ -101,6 +182,19 @@ class InputShaper:
                                desc=self.cmd_SET_INPUT_SHAPER_help)
     def get_shapers(self):
         return self.shapers
+    def has_freq_map(self, axis):
+        # The 'xy' axis checks both the x and y shapers
+        return any([shaper.axis in axis
+                    and shaper.params.freq_map is not None
+                    for shaper in self.shapers])
+    def set_freq_map(self, axis, shaper_type, shaper_freq,
+                     freq_map, map_min, map_max):
+        for shaper in self.shapers:
+            if shaper.axis == axis:
+                shaper.params.shaper_type = shaper_type
+                shaper.params.shaper_freq = shaper_freq
+                shaper.set_freq_map(freq_map, map_min, map_max)
+        self._update_input_shaping()
     def connect(self):
         self.toolhead = self.printer.lookup_object("toolhead")
         # Configure initial values
@@ -27,6 +27,11 @@ REG_MOD_READ = 0x80
 
 LIS2DW_DEV_ID = 0x44
 
+# High-Performance mode CTRL_REG1 settings for each output data rate
+QUERY_RATES = {
+    200: 0x64, 400: 0x74, 800: 0x84, 1600: 0x94,
+}
+
 FREEFALL_ACCEL = 9.80665
 SCALE = FREEFALL_ACCEL * 1.952 / 4
 
@@ -40,6 +45,10 @@ class LIS2DW:
         adxl345.AccelCommandHelper(config, self)
         self.axes_map = adxl345.read_axes_map(config, SCALE, SCALE, SCALE)
         self.data_rate = 1600
+        self.query_rate = self.data_rate
+        self.monitor_rates = {}
+        self.is_restarting = False
+        self.rate_start_time = 0.
         # Setup mcu sensor_lis2dw bulk query code
         self.spi = bus.MCU_SPI_from_config(config, 3, default_speed=5000000)
         self.mcu = mcu = self.spi.get_mcu()
@@ -57,7 +66,8 @@ class LIS2DW:
         # Process messages in batches
         self.batch_bulk = bulk_sensor.BatchBulkHelper(
             self.printer, self._process_batch,
-            self._start_measurements, self._finish_measurements, BATCH_UPDATES)
+            self._start_measurements, self._finish_measurements, BATCH_UPDATES,
+            self._update_query_rate)
         self.name = config.get_name().split()[-1]
         hdr = ('time', 'x_acceleration', 'y_acceleration', 'z_acceleration')
         self.batch_bulk.add_mux_endpoint("lis2dw/dump_lis2dw", "sensor",
@@ -85,7 +95,39 @@ class LIS2DW:
     def start_internal_client(self):
         aqh = adxl345.AccelQueryHelper(self.printer)
         self.batch_bulk.add_client(aqh.handle_batch)
+        # Don't report samples taken at a previous query rate
+        aqh.request_start_time = max(aqh.request_start_time,
+                                     self.rate_start_time)
         return aqh
+    def start_monitor_client(self, client_cb, rate):
+        # Add a client that only needs measurements at the given
+        # (reduced) rate.  The chip runs at the full data rate while
+        # any other client is active.
+        if rate not in QUERY_RATES or rate > self.data_rate:
+            raise self.printer.command_error(
+                "Unsupported lis2dw monitoring rate %d" % (rate,))
+        self.monitor_rates[client_cb] = rate
+        self.batch_bulk.add_client(client_cb)
+    # Query rate selection
+    def _get_query_rate(self):
+        client_cbs = self.batch_bulk.client_cbs
+        for client_cb in list(self.monitor_rates):
+            if client_cb not in client_cbs:
+                del self.monitor_rates[client_cb]
+        rates = [self.monitor_rates.get(cb, self.data_rate)
+                 for cb in client_cbs]
+        return max(rates or [self.data_rate])
+    def _update_query_rate(self):
+        # Restart measurements if the active clients need another rate
+        # (called when a client is added or removed)
+        if self.is_restarting or self._get_query_rate() == self.query_rate:
+            return
+        self.is_restarting = True
+        try:
+            self._finish_measurements()
+            self._start_measurements()
+        finally:
+            self.is_restarting = False
     # Measurement decoding
     def _convert_samples(self, samples):
         (x_pos, x_scale), (y_pos, y_scale), (z_pos, z_scale) = self.axes_map
@@ -116,18 +158,23 @@ class LIS2DW:
         # Continuous mode: If the FIFO is full
         # the new sample overwrites the older sample.
         self.set_reg(REG_LIS2DW_FIFO_CTRL, 0xC0)
-        # High-Performance / Low-Power mode 1600/200 Hz
-        # High-Performance Mode (14-bit resolution)
-        self.set_reg(REG_LIS2DW_CTRL_REG1_ADDR, 0x94)
+        # High-Performance Mode (14-bit resolution) at the query rate
+        self.query_rate = rate = self._get_query_rate()
+        self.set_reg(REG_LIS2DW_CTRL_REG1_ADDR, QUERY_RATES[rate])
+        self.ffreader.clock_sync.chip_clock_smooth = rate * BATCH_UPDATES * 2
 
         # Start bulk reading
-        rest_ticks = self.mcu.seconds_to_clock(4. / self.data_rate)
+        rest_ticks = self.mcu.seconds_to_clock(4. / rate)
         self.query_lis2dw_cmd.send([self.oid, rest_ticks])
         self.set_reg(REG_LIS2DW_FIFO_CTRL, 0xC0)
-        logging.info("LIS2DW starting '%s' measurements", self.name)
+        logging.info("LIS2DW starting '%s' measurements at %d Hz",
+                     self.name, rate)
         # Initialize clock tracking
         self.ffreader.note_start()
         self.last_error_count = 0
+        reactor = self.printer.get_reactor()
+        self.rate_start_time = self.mcu.estimated_print_time(
+            reactor.monotonic())
     def _finish_measurements(self):
         # Halt bulk reading
         self.set_reg(REG_LIS2DW_FIFO_CTRL, 0x00)
@@ -136,6 +183,8 @@ class LIS2DW:
         logging.info("LIS2DW finished '%s' measurements", self.name)
         self.set_reg(REG_LIS2DW_FIFO_CTRL, 0x00)
     def _process_batch(self, eventtime):
+        if self.is_restarting:
+            return {}
         samples = self.ffreader.pull_samples()
         self._convert_samples(samples)
         if not samples:
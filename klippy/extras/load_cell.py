@@ -3,8 +3,11 @@
 # Copyright (C) 2024 Gareth Farrington <gareth@waves.ky>
 #
 # This file may be distributed under the terms of the GNU GPLv3 license.
+import logging
+import mcu
 from . import hx71x
 from . import ads1220
+from . import probe
 
 # Printer class that controls a load cell
 class LoadCell:
@@ -18,13 +21,224 @@ class LoadCell:
     def get_sensor(self):
         return self.sensor
 
-def load_config(config):
+MIN_FIT_POINTS = 3
+
+# Least squares fit of the contact "knee" in a force versus height
+# curve.  Above the contact height the force is flat, below it the
+# force changes linearly with the height.
+def _calc_knee_error(points, contact_z):
+    n = sx = sxx = sf = sxf = sff = 0.
+    for z, force in points:
+        x = max(0., contact_z - z)
+        n += 1.
+        sx += x
+        sxx += x * x
+        sf += force
+        sxf += x * force
+        sff += force * force
+    det = n * sxx - sx * sx
+    if det <= 0.:
+        return None, 0.
+    slope = (n * sxf - sx * sf) / det
+    base = (sf - slope * sx) / n
+    return sff - base * sf - slope * sxf, slope
+
+# Returns the fitted contact height (or None if no knee was found)
+def fit_contact_point(points):
+    heights = sorted(set([z for z, force in points]))
+    if len(heights) < 2 * MIN_FIT_POINTS:
+        return None
+    # Coarse search over the sampled heights
+    best_err = best_idx = None
+    for i in range(MIN_FIT_POINTS, len(heights) - MIN_FIT_POINTS + 1):
+        err, slope = _calc_knee_error(points, heights[i])
+        if err is not None and slope and (best_err is None or err < best_err):
+            best_err, best_idx = err, i
+    # The knee must fit much better than a straight line (as seen when
+    # the sampled range does not include the contact point)
+    line_err, slope = _calc_knee_error(points, heights[-1])
+    if best_idx is None or best_err > .5 * line_err:
+        return None
+    # Golden section search between the neighboring heights
+    low, high = heights[best_idx - 1], heights[best_idx + 1]
+    ratio = (5.**.5 - 1.) / 2.
+    for i in range(30):
+        z1 = high - ratio * (high - low)
+        z2 = low + ratio * (high - low)
+        if _calc_knee_error(points, z1)[0] < _calc_knee_error(points, z2)[0]:
+            high = z2
+        else:
+            low = z1
+    return .5 * (low + high)
+
+# Endstop that triggers on a force threshold evaluated on the mcu
+class LoadCellEndstop:
+    REASON_SENSOR_ERROR = mcu.MCU_trsync.REASON_COMMS_TIMEOUT + 1
+    def __init__(self, config, sensor):
+        self._printer = config.get_printer()
+        self._sensor = sensor
+        if not hasattr(sensor, 'setup_home'):
+            raise config.error("%s: sensor_type does not support probing"
+                               % (config.get_name(),))
+        self._mcu = sensor.get_mcu()
+        self._z_offset = config.getfloat('z_offset')
+        # Trigger thresholds (in raw sensor counts)
+        range_max = sensor.get_range()[1]
+        self._trigger_force = config.getint('trigger_force', minval=1,
+                                            maxval=range_max)
+        self._trigger_slope = config.getint('trigger_slope', 0, minval=0,
+                                            maxval=range_max)
+        self._tare_samples = config.getint('tare_samples', 8, minval=1,
+                                           maxval=32)
+        self._filter_shift = config.getint('filter_shift', 2, minval=0,
+                                           maxval=6)
+        # Contact point refinement from the force curve
+        self._refine_contact = config.getboolean('refine_contact', False)
+        self._fit_time = config.getfloat('contact_fit_time', 0.150, above=0.)
+        self._dispatch = mcu.TriggerDispatch(self._mcu)
+        self._trigger_time = 0.
+        self._streaming = self._client_active = False
+        self._collecting = False
+        self._samples = []
+        self._last_sample_time = 0.
+    def _handle_batch(self, msg):
+        self._client_active = self._streaming
+        if self._collecting and msg['data']:
+            self._samples.extend([(t, counts)
+                                  for t, counts, value in msg['data']])
+            self._last_sample_time = msg['data'][-1][0]
+        return self._streaming
+    # Interface for MCU_endstop
+    def get_mcu(self):
+        return self._mcu
+    def add_stepper(self, stepper):
+        self._dispatch.add_stepper(stepper)
+    def get_steppers(self):
+        return self._dispatch.get_steppers()
+    def get_trigger_latency(self):
+        return self._dispatch.get_trigger_latency()
+    def home_start(self, print_time, sample_time, sample_count, rest_time,
+                   triggered=True):
+        self._trigger_time = 0.
+        trigger_completion = self._dispatch.start(print_time)
+        self._sensor.setup_home(
+            print_time, self._trigger_force, self._trigger_slope,
+            self._tare_samples, self._filter_shift, self._dispatch.get_oid(),
+            mcu.MCU_trsync.REASON_ENDSTOP_HIT, self.REASON_SENSOR_ERROR)
+        return trigger_completion
+    def home_wait(self, home_end_time):
+        self._dispatch.wait_end(home_end_time)
+        trigger_time = self._sensor.clear_home()
+        res = self._dispatch.stop()
+        if res >= mcu.MCU_trsync.REASON_COMMS_TIMEOUT:
+            if res == mcu.MCU_trsync.REASON_COMMS_TIMEOUT:
+                raise self._printer.command_error(
+                    "Communication timeout during homing")
+            raise self._printer.command_error("Load cell sensor error")
+        if res != mcu.MCU_trsync.REASON_ENDSTOP_HIT:
+            return 0.
+        if self._mcu.is_fileoutput():
+            trigger_time = home_end_time
+        self._trigger_time = trigger_time
+        return trigger_time
+    def query_endstop(self, print_time):
+        return False
+    # Contact point refinement
+    def _await_samples(self, end_time):
+        if self._mcu.is_fileoutput():
+            # No samples arrive in batch mode (the fit then falls back
+            # to the trigger position)
+            return
+        reactor = self._printer.get_reactor()
+        while self._last_sample_time < end_time:
+            systime = reactor.monotonic()
+            est_print_time = self._mcu.estimated_print_time(systime)
+            if est_print_time > end_time + 1.0:
+                raise self._printer.command_error("Load cell sensor outage")
+            reactor.pause(systime + 0.010)
+    def _fit_contact(self):
+        trigger_time = self._trigger_time
+        self._await_samples(trigger_time)
+        # Find the toolhead height of each sample from the stepper history
+        kin = self._printer.lookup_object('toolhead').get_kinematics()
+        steppers = kin.get_steppers()
+        start_time = trigger_time - self._fit_time
+        points = []
+        for samp_time, counts in self._samples:
+            if samp_time < start_time or samp_time > trigger_time:
+                continue
+            kin_spos = {s.get_name(): s.mcu_to_commanded_position(
+                            s.get_past_mcu_position(samp_time))
+                        for s in steppers}
+            points.append((kin.calc_position(kin_spos)[2], counts))
+        del self._samples[:]
+        return fit_contact_point(points)
+    # Interface for ProbeEndstopWrapper
+    def probing_move(self, pos, speed):
+        phoming = self._printer.lookup_object('homing')
+        try:
+            epos = phoming.probing_move(self, pos, speed)
+            if not self._refine_contact or not self._trigger_time:
+                return epos
+            contact_z = self._fit_contact()
+        finally:
+            self._collecting = False
+        if contact_z is None:
+            logging.info("load_cell_probe: unable to fit contact point,"
+                         " using trigger position")
+            return epos
+        epos[2] = contact_z
+        return epos
+    def multi_probe_begin(self):
+        # The mcu only checks the force while the sensor is sampling
+        self._streaming = True
+        if self._client_active or self._mcu.is_fileoutput():
+            return
+        self._client_active = True
+        self._sensor.add_client(self._handle_batch)
+    def multi_probe_end(self):
+        self._streaming = False
+    def probe_prepare(self, hmove):
+        if not self._streaming:
+            raise self._printer.command_error(
+                "Load cell probe used outside of a probe session")
+        del self._samples[:]
+        self._collecting = self._refine_contact
+    def probe_finish(self, hmove):
+        pass
+    def get_position_endstop(self):
+        return self._z_offset
+
+# Probe that detects contact with the bed using a load cell
+class LoadCellProbe:
+    def __init__(self, config):
+        self.printer = config.get_printer()
+        self.load_cell = LoadCell(config, create_sensor(config))
+        self.mcu_probe = LoadCellEndstop(config, self.load_cell.get_sensor())
+        self.cmd_helper = probe.ProbeCommandHelper(
+            config, self, self.mcu_probe.query_endstop)
+        self.probe_offsets = probe.ProbeOffsetsHelper(config)
+        self.probe_session = probe.ProbeSessionHelper(config, self.mcu_probe)
+        self.printer.add_object('probe', self)
+    def get_probe_params(self, gcmd=None):
+        return self.probe_session.get_probe_params(gcmd)
+    def get_offsets(self):
+        return self.probe_offsets.get_offsets()
+    def get_status(self, eventtime):
+        return self.cmd_helper.get_status(eventtime)
+    def start_probe_session(self, gcmd):
+        return self.probe_session.start_probe_session(gcmd)
+
+def create_sensor(config):
     # Sensor types
     sensors = {}
     sensors.update(hx71x.HX71X_SENSOR_TYPES)
     sensors.update(ads1220.ADS1220_SENSOR_TYPE)
     sensor_class = config.getchoice('sensor_type', sensors)
-    return LoadCell(config, sensor_class(config))
+    return sensor_class(config)
+
+def load_config(config):
+    return LoadCell(config, create_sensor(config))
 
 def load_config_prefix(config):
     return load_config(config)
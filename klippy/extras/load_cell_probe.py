@@ -0,0 +1,9 @@
+# Load cell based Z probe
+#
+# Copyright (C) 2026  pulponair <pulponair@users.noreply.github.com>
+#
+# This file may be distributed under the terms of the GNU GPLv3 license.
+from . import load_cell
+
+def load_config(config):
+    return load_cell.LoadCellProbe(config)
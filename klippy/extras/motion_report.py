@@ -143,6 +143,9 @@ class PrinterMotionReport:
             'live_velocity': 0., 'live_extruder_velocity': 0.,
             'steppers': [], 'trapq': [],
         }
+        webhooks = self.printer.lookup_object('webhooks')
+        self.note_status_change = webhooks.register_status_notifier(
+            'motion_report', ['steppers', 'trapq']).note_change
         # Register handlers
         self.printer.register_event_handler("klippy:connect", self._connect)
         self.printer.register_event_handler("klippy:shutdown", self._shutdown)
@@ -167,6 +170,7 @@ class PrinterMotionReport:
         # Populate 'trapq' and 'steppers' in get_status result
         self.last_status['steppers'] = list(sorted(self.steppers.keys()))
         self.last_status['trapq'] = list(sorted(self.trapqs.keys()))
+        self.note_status_change(('steppers', 'trapq'))
     # Shutdown handling
     def _dump_shutdown(self, eventtime):
         # Log stepper queue_steps on mcu that started shutdown (if any)
@@ -210,12 +214,12 @@ class PrinterMotionReport:
         # Calculate current requested toolhead position
         mcu = self.printer.lookup_object('mcu')
         print_time = mcu.estimated_print_time(eventtime)
+        toolhead = self.printer.lookup_object('toolhead')
         pos, velocity = self.trapqs['toolhead'].get_trapq_position(print_time)
         if pos is not None:
-            xyzpos = pos[:3]
+            xyzpos = tuple(toolhead.calc_physical_position(pos)[:3])
             xyzvelocity = velocity
         # Calculate requested position of currently active extruder
-        toolhead = self.printer.lookup_object('toolhead')
         ehandler = self.trapqs.get(toolhead.get_extruder().get_name())
         if ehandler is not None:
             pos, velocity = ehandler.get_trapq_position(print_time)
@@ -0,0 +1,233 @@
+# Calibration of heater model predictive control (MPC) settings
+#
+# Copyright (C) 2026  pulponair <pulponair@users.noreply.github.com>
+#
+# This file may be distributed under the terms of the GNU GPLv3 license.
+import math, logging
+from . import heaters
+
+class MPCCalibrate:
+    def __init__(self, config):
+        self.printer = config.get_printer()
+        gcode = self.printer.lookup_object('gcode')
+        gcode.register_command('MPC_CALIBRATE', self.cmd_MPC_CALIBRATE,
+                               desc=self.cmd_MPC_CALIBRATE_help)
+    cmd_MPC_CALIBRATE_help = "Run MPC calibration test"
+    def cmd_MPC_CALIBRATE(self, gcmd):
+        heater_name = gcmd.get('HEATER')
+        target = gcmd.get_float('TARGET')
+        fan_name = gcmd.get('FAN', None)
+        write_file = gcmd.get_int('WRITE_FILE', 0)
+        pheaters = self.printer.lookup_object('heaters')
+        try:
+            heater = pheaters.lookup_heater(heater_name)
+        except self.printer.config_error as e:
+            raise gcmd.error(str(e))
+        heater_power = None
+        if isinstance(heater.control, heaters.ControlMPC):
+            heater_power = heater.control.get_profile()['heater_power']
+        heater_power = gcmd.get_float('HEATER_POWER', heater_power, above=0.)
+        if heater_power is None:
+            raise gcmd.error("HEATER_POWER must be specified")
+        fan = None
+        if fan_name is not None:
+            fan = self.printer.lookup_object(fan_name, None)
+            if not hasattr(fan, 'fan'):
+                raise gcmd.error("Unknown fan '%s'" % (fan_name,))
+        self.printer.lookup_object('toolhead').get_last_move_time()
+        calibrate = ControlMPCAutoTune(heater, heater_power)
+        old_control = heater.set_control(calibrate)
+        try:
+            pheaters.set_temperature(heater, target, True)
+            if calibrate.error is not None:
+                raise gcmd.error(calibrate.error)
+            if fan is not None and not calibrate.check_busy(0., 0., 0.):
+                # Repeat the measurement with the fan at full speed
+                fan.fan.set_speed(1.)
+                calibrate.start_hold()
+                pheaters.set_temperature(heater, target, True)
+        finally:
+            if fan is not None:
+                fan.fan.set_speed(0.)
+            heater.set_control(old_control)
+            if write_file:
+                calibrate.write_file('/tmp/heattest.txt')
+        if calibrate.check_busy(0., 0., 0.):
+            raise gcmd.error("mpc_calibrate interrupted")
+        # Log and report results
+        profile = calibrate.calc_final_profile()
+        params = [('heater_power', "%.3f" % (heater_power,))]
+        params += [('mpc_' + name, "%.6f" % (profile[name],))
+                   for name in ['block_heat_capacity', 'sensor_responsiveness',
+                                'ambient_transfer', 'fan_ambient_transfer']
+                   if name in profile]
+        if fan is not None:
+            params.append(('mpc_cooling_fan', fan_name))
+        msg = " ".join(["%s=%s" % (name, value) for name, value in params])
+        logging.info("MPC autotune: final: %s", msg)
+        gcmd.respond_info(
+            "MPC parameters: %s\n"
+            "The SAVE_CONFIG command will update the printer config file\n"
+            "with these parameters and restart the printer." % (msg,))
+        # Store results for SAVE_CONFIG
+        cfgname = heater.get_name()
+        configfile = self.printer.lookup_object('configfile')
+        configfile.set(cfgname, 'control', 'mpc')
+        for name, value in params:
+            configfile.set(cfgname, name, value)
+
+TUNE_MIN_RISE = 50.
+TUNE_SETTLE_TIME = 30.
+TUNE_MEASURE_TIME = 30.
+
+class ControlMPCAutoTune:
+    def __init__(self, heater, heater_power):
+        self.heater = heater
+        self.heater_max_power = heater.get_max_power()
+        self.heater_power = heater_power
+        self.state = 'heatup'
+        self.error = None
+        # Heat up curve
+        self.ambient_temp = None
+        self.heater_on_time = 0.
+        self.heatup_samples = []
+        self.time_constant = 0.
+        self.profile = None
+        # Hold measurements
+        self.model = None
+        self.last_time = self.last_power = 0.
+        self.hold_start = 0.
+        self.measure_time = self.measure_energy = self.measure_temp = 0.
+        self.results = []
+        # Sample recording
+        self.last_pwm = 0.
+        self.pwm_samples = []
+        self.temp_samples = []
+    # Heater control
+    def set_pwm(self, read_time, value):
+        if value != self.last_pwm:
+            self.pwm_samples.append(
+                (read_time + self.heater.get_pwm_delay(), value))
+            self.last_pwm = value
+        self.heater.set_pwm(read_time, value)
+        self.last_power = value * self.heater_power
+    def start_hold(self):
+        self.state = 'settle'
+    def temperature_update(self, read_time, temp, target_temp):
+        self.temp_samples.append((read_time, temp))
+        time_diff = read_time - self.last_time
+        self.last_time = read_time
+        if self.error is not None:
+            self.set_pwm(read_time, 0.)
+            return
+        if self.state == 'heatup':
+            # Heat at full power until the target temperature is reached
+            if self.ambient_temp is None:
+                self.ambient_temp = temp
+                self.heater_on_time = read_time + self.heater.get_pwm_delay()
+            self.heatup_samples.append((read_time, temp))
+            if temp < target_temp:
+                self.set_pwm(read_time, self.heater_max_power)
+                return
+            self.fit_heatup()
+            if self.error is not None:
+                self.set_pwm(read_time, 0.)
+                self.state = 'done'
+                return
+            self.model = heaters.MPCModel(self.profile, temp,
+                                          self.ambient_temp)
+            self.state = 'settle'
+        else:
+            self.model.update(temp, time_diff, self.last_power,
+                              self.profile['ambient_transfer'])
+        if self.state == 'settle':
+            self.hold_start = read_time
+            self.measure_time = self.measure_energy = self.measure_temp = 0.
+            self.state = 'hold'
+        elif (self.state == 'hold'
+              and read_time > self.hold_start + TUNE_SETTLE_TIME):
+            # Measure the average power needed to hold the temperature
+            self.measure_time += time_diff
+            self.measure_energy += self.last_power * time_diff
+            self.measure_temp += temp * time_diff
+            if self.measure_time >= TUNE_MEASURE_TIME:
+                self.results.append((self.measure_energy / self.measure_time,
+                                     self.measure_temp / self.measure_time))
+                self.state = 'done'
+        # Hold the target temperature using the estimated model
+        power = self.model.calc_power(target_temp,
+                                      self.profile['ambient_transfer'],
+                                      self.profile['target_reach_time'])
+        co = power / self.heater_power
+        self.set_pwm(read_time, max(0., min(self.heater_max_power, co)))
+    def check_busy(self, eventtime, smoothed_temp, target_temp):
+        return self.state != 'done'
+    # Analysis
+    def _interp_temp(self, req_time):
+        samples = self.heatup_samples
+        for (time1, temp1), (time2, temp2) in zip(samples[:-1], samples[1:]):
+            if time2 >= req_time:
+                return temp1 + (temp2 - temp1) * ((req_time - time1)
+                                                  / (time2 - time1))
+        return samples[-1][1]
+    def fit_heatup(self):
+        # Fit an exponential to three equally spaced points of the
+        # later (sensor lag free) part of the heat up curve
+        ambient_temp = self.ambient_temp
+        end_time, end_temp = self.heatup_samples[-1]
+        rise = end_temp - ambient_temp
+        if rise < TUNE_MIN_RISE:
+            self.error = ("Heater must start at least %.0f degrees below"
+                          " the target temperature" % (TUNE_MIN_RISE,))
+            return
+        time1 = [t for t, temp in self.heatup_samples
+                 if temp - ambient_temp >= rise / 3.][0]
+        time2 = .5 * (time1 + end_time)
+        temp1 = self._interp_temp(time1)
+        temp2 = self._interp_temp(time2)
+        ratio = (end_temp - temp2) / (temp2 - temp1)
+        if not 0. < ratio < 1.:
+            self.error = ("Unable to fit the heat up curve"
+                          " (try a higher TARGET)")
+            return
+        time_constant = (time2 - time1) / -math.log(ratio)
+        asymptote = temp1 + (temp2 - temp1) / (1. - ratio)
+        ambient_transfer = self.heater_power / (asymptote - ambient_temp)
+        # The delay before the fitted curve leaves the ambient
+        # temperature is the sensor response time
+        start_time = time1 + time_constant * math.log(
+            (asymptote - temp1) / (asymptote - ambient_temp))
+        sensor_delay = max(start_time - self.heater_on_time, .1)
+        logging.info("MPC autotune: ambient=%.3f asymptote=%.3f tau=%.3f"
+                     " delay=%.3f", ambient_temp, asymptote, time_constant,
+                     sensor_delay)
+        self.time_constant = time_constant
+        self.profile = {
+            'heater_power': self.heater_power,
+            'block_heat_capacity': ambient_transfer * time_constant,
+            'sensor_responsiveness': 1. / sensor_delay,
+            'ambient_transfer': ambient_transfer,
+            'target_reach_time': 2., 'smoothing': .5}
+    def calc_final_profile(self):
+        # Refine the heat loss using the power measured while holding
+        # the target temperature
+        profile = dict(self.profile)
+        transfers = [power / (temp - self.ambient_temp)
+                     for power, temp in self.results]
+        profile['ambient_transfer'] = transfers[0]
+        profile['block_heat_capacity'] = transfers[0] * self.time_constant
+        if len(transfers) > 1:
+            profile['fan_ambient_transfer'] = max(0.,
+                                                  transfers[1] - transfers[0])
+        return profile
+    # Offline analysis helper
+    def write_file(self, filename):
+        pwm = ["pwm: %.3f %.3f" % (time, value)
+               for time, value in self.pwm_samples]
+        out = ["%.3f %.3f" % (time, temp) for time, temp in self.temp_samples]
+        f = open(filename, "w")
+        f.write('\n'.join(pwm + out))
+        f.close()
+
+def load_config(config):
+    return MPCCalibrate(config)
@@ -9,6 +9,11 @@ class PrintStats:
         printer = config.get_printer()
         self.gcode_move = printer.load_object(config, 'gcode_move')
         self.reactor = printer.get_reactor()
+        # Durations and filament usage are computed in get_status()
+        webhooks = printer.lookup_object('webhooks')
+        self.note_status_change = webhooks.register_status_notifier(
+            'print_stats', ['filename', 'state', 'message', 'info']
+        ).note_change
         self.reset()
         # Register commands
         self.gcode = printer.lookup_object('gcode')
@@ -24,6 +29,7 @@ class PrintStats:
     def set_current_file(self, filename):
         self.reset()
         self.filename = filename
+        self.note_status_change(('filename',))
     def note_start(self):
         curtime = self.reactor.monotonic()
         if self.print_start_time is None:
@@ -38,6 +44,7 @@ class PrintStats:
         self.last_epos = gc_status['position'].e
         self.state = "printing"
         self.error_message = ""
+        self.note_status_change(('state', 'message'))
     def note_pause(self):
         if self.last_pause_time is None:
             curtime = self.reactor.monotonic()
@@ -46,6 +53,7 @@ class PrintStats:
             self._update_filament_usage(curtime)
         if self.state != "error":
             self.state = "paused"
+            self.note_status_change(('state',))
     def note_complete(self):
         self._note_finish("complete")
     def note_error(self, message):
@@ -57,6 +65,7 @@ class PrintStats:
             return
         self.state = state
         self.error_message = error_message
+        self.note_status_change(('state', 'message'))
         eventtime = self.reactor.monotonic()
         self.total_duration = eventtime - self.print_start_time
         if self.filament_used < 0.0000001:
@@ -82,6 +91,7 @@ class PrintStats:
                 current_layer is not None and \
                 current_layer != self.info_current_layer:
             self.info_current_layer = min(current_layer, self.info_total_layer)
+        self.note_status_change(('info',))
     def reset(self):
         self.filename = self.error_message = ""
         self.state = "standby"
@@ -91,6 +101,7 @@ class PrintStats:
         self.init_duration = 0.
         self.info_total_layer = None
         self.info_current_layer = None
+        self.note_status_change()
     def get_status(self, eventtime):
         time_paused = self.prev_pause_duration
         if self.print_start_time is not None:
@@ -13,6 +13,9 @@ consider reducing the Z axis minimum position so the probe
 can travel further (the Z minimum position can be negative).
 """
 
+# Extra time allowed for the probe to release after a multi_tap tap
+TAP_HOLD_MARGIN = 0.250
+
 # Calculate the average Z from a set of positions
 def calc_probe_z_average(positions, method='average'):
     if method != 'median':
@@ -259,6 +262,12 @@ class ProbeSessionHelper:
                                                  minval=0.)
         self.samples_retries = config.getint('samples_tolerance_retries', 0,
                                              minval=0)
+        # Record additional samples in a single down/up oscillating move
+        self.multi_tap = config.getboolean('multi_tap', False)
+        self.tap_overtravel = config.getfloat('tap_overtravel', 0.5, above=0.)
+        if self.multi_tap and not hasattr(mcu_probe, 'tap_probing_move'):
+            raise config.error("Probe in section '%s' does not support"
+                               " multi_tap" % (config.get_name(),))
         # Session state
         self.multi_probe_pending = False
         self.results = []
@@ -277,6 +286,7 @@ class ProbeSessionHelper:
     def start_probe_session(self, gcmd):
         if self.multi_probe_pending:
             self._probe_state_error()
+        self.printer.send_event("probe:session_begin")
         self.mcu_probe.multi_probe_begin()
         self.multi_probe_pending = True
         self.results = []
@@ -300,13 +310,16 @@ class ProbeSessionHelper:
         samples_retries = gcmd.get_int("SAMPLES_TOLERANCE_RETRIES",
                                        self.samples_retries, minval=0)
         samples_result = gcmd.get("SAMPLES_RESULT", self.samples_result)
+        multi_tap = gcmd.get_int("MULTI_TAP", self.multi_tap,
+                                 minval=0, maxval=1)
         return {'probe_speed': probe_speed,
                 'lift_speed': lift_speed,
                 'samples': samples,
                 'sample_retract_dist': sample_retract_dist,
                 'samples_tolerance': samples_tolerance,
                 'samples_tolerance_retries': samples_retries,
-                'samples_result': samples_result}
+                'samples_result': samples_result,
+                'multi_tap': multi_tap}
     def _probe(self, speed, non_contact_probe=True):
         toolhead = self.printer.lookup_object('toolhead')
         curtime = self.printer.get_reactor().monotonic()
@@ -331,6 +344,38 @@ class ProbeSessionHelper:
         gcode.respond_info("probe at %.3f,%.3f is z=%.6f"
                            % (epos[0], epos[1], epos[2]))
         return epos[:3]
+    def _tap_probe(self, first_pos, count, params):
+        if not hasattr(self.mcu_probe, 'tap_probing_move'):
+            raise self.printer.command_error(
+                "Probe does not support multi_tap")
+        count = min(count, self.mcu_probe.get_max_taps())
+        if not count:
+            raise self.printer.command_error(
+                "Probe mcu does not support multi_tap")
+        # Oscillate between the current position and just below the
+        # height of the first sample
+        toolhead = self.printer.lookup_object('toolhead')
+        top = toolhead.get_position()
+        bottom = list(top)
+        bottom[2] = max(first_pos[2] - self.tap_overtravel, self.z_position)
+        probe_speed, lift_speed = params['probe_speed'], params['lift_speed']
+        moves = [(bottom, probe_speed), (top, lift_speed)] * count
+        # Longest time the probe should remain triggered during a tap
+        hold_time = (2. * self.tap_overtravel / min(probe_speed, lift_speed)
+                     + TAP_HOLD_MARGIN)
+        phoming = self.printer.lookup_object('homing')
+        epositions = phoming.tap_probing_move(self.mcu_probe, moves, count,
+                                              hold_time)
+        if len(epositions) != count:
+            raise self.printer.command_error(
+                "Probe recorded %d taps (expected %d)"
+                % (len(epositions), count))
+        gcode = self.printer.lookup_object('gcode')
+        for epos in epositions:
+            self.printer.send_event("probe:update_results", epos)
+            gcode.respond_info("probe at %.3f,%.3f is z=%.6f"
+                               % (epos[0], epos[1], epos[2]))
+        return [epos[:3] for epos in epositions]
     def run_probe(self, gcmd):
         if not self.multi_probe_pending:
             self._probe_state_error()
@@ -343,8 +388,13 @@ class ProbeSessionHelper:
         sample_count = params['samples']
         while len(positions) < sample_count:
             # Probe position
-            pos = self._probe(params['probe_speed'], non_contact_probe)
-            positions.append(pos)
+            if positions and params['multi_tap']:
+                positions.extend(self._tap_probe(
+                    positions[0], sample_count - len(positions), params))
+            else:
+                positions.append(self._probe(params['probe_speed'],
+                                             non_contact_probe))
+            pos = positions[-1]
             # Check samples tolerance
             z_positions = [p[2] for p in positions]
             if max(z_positions)-min(z_positions) > params['samples_tolerance']:
@@ -396,9 +446,11 @@ class ProbePointsHelper:
         def_move_z = config.getfloat('horizontal_move_z', 5.)
         self.default_horizontal_move_z = def_move_z
         self.speed = config.getfloat('speed', 50., above=0.)
+        self.pipelined = config.getboolean('pipelined_probing', False)
         self.use_offsets = False
         # Internal probing state
         self.lift_speed = self.speed
+        self.retract_dist = 0.
         self.probe_offsets = (0., 0., 0.)
         self.manual_results = []
     def minimum_points(self,n):
@@ -427,13 +479,26 @@ class ProbePointsHelper:
         # Invoke callback
         res = self.finalize_callback(self.probe_offsets, results)
         return res != "retry"
-    def _move_next(self, probe_num):
-        # Move to next XY probe point
+    def _get_next_pos(self, probe_num):
         nextpos = list(self.probe_points[probe_num])
         if self.use_offsets:
             nextpos[0] -= self.probe_offsets[0]
             nextpos[1] -= self.probe_offsets[1]
-        self._move(nextpos, self.speed)
+        return nextpos
+    def _move_next(self, probe_num):
+        # Move to next XY probe point
+        self._move(self._get_next_pos(probe_num), self.speed)
+    def _travel_next(self, probe_num):
+        # Lift by the sample retract distance and then move to the next
+        # probe point, so the rest of the climb to horizontal_move_z
+        # overlaps the xy travel
+        toolhead = self.printer.lookup_object('toolhead')
+        curz = toolhead.get_position()[2]
+        lift_z = min(curz + self.retract_dist, self.horizontal_move_z)
+        if lift_z > curz:
+            self._move([None, None, lift_z], self.lift_speed)
+        self._move(self._get_next_pos(probe_num) + [self.horizontal_move_z],
+                   self.speed)
     def start_probe(self, gcmd):
         manual_probe.verify_no_manual_probe(self.printer)
         # Lookup objects
@@ -450,23 +515,30 @@ class ProbePointsHelper:
             self._manual_probe_start()
             return
         # Perform automatic probing
-        self.lift_speed = probe.get_probe_params(gcmd)['lift_speed']
+        params = probe.get_probe_params(gcmd)
+        self.lift_speed = params['lift_speed']
+        self.retract_dist = params['sample_retract_dist']
         self.probe_offsets = probe.get_offsets()
         if self.horizontal_move_z < self.probe_offsets[2]:
             raise gcmd.error("horizontal_move_z can't be less than"
                              " probe's z_offset")
+        pipelined = gcmd.get_int('PIPELINED', self.pipelined,
+                                 minval=0, maxval=1)
         probe_session = probe.start_probe_session(gcmd)
         probe_num = 0
         while 1:
-            self._raise_tool(not probe_num)
-            if probe_num >= len(self.probe_points):
-                results = probe_session.pull_probed_results()
-                done = self._invoke_callback(results)
-                if done:
-                    break
-                # Caller wants a "retry" - restart probing
-                probe_num = 0
-            self._move_next(probe_num)
+            if pipelined and 0 < probe_num < len(self.probe_points):
+                self._travel_next(probe_num)
+            else:
+                self._raise_tool(not probe_num)
+                if probe_num >= len(self.probe_points):
+                    results = probe_session.pull_probed_results()
+                    done = self._invoke_callback(results)
+                    if done:
+                        break
+                    # Caller wants a "retry" - restart probing
+                    probe_num = 0
+                self._move_next(probe_num)
             probe_session.run_probe(gcmd)
             probe_num += 1
         probe_session.end_probe_session()
@@ -523,6 +595,7 @@ class ProbeEndstopWrapper:
         self.home_start = self.mcu_endstop.home_start
         self.home_wait = self.mcu_endstop.home_wait
         self.query_endstop = self.mcu_endstop.query_endstop
+        self.get_trigger_latency = self.mcu_endstop.get_trigger_latency
         # multi probes state
         self.multi = 'OFF'
     def _raise_probe(self):
@@ -551,6 +624,20 @@ class ProbeEndstopWrapper:
     def probing_move(self, pos, speed):
         phoming = self.printer.lookup_object('homing')
         return phoming.probing_move(self, pos, speed)
+    def get_max_taps(self):
+        if not hasattr(self.mcu_endstop, 'get_max_taps'):
+            return 0
+        return self.mcu_endstop.get_max_taps()
+    def tap_start(self, print_time, sample_time, sample_count, rest_time,
+                  tap_count, hold_time):
+        return self.mcu_endstop.tap_start(print_time, sample_time,
+                                          sample_count, rest_time,
+                                          tap_count, hold_time)
+    def tap_wait(self, tap_end_time):
+        return self.mcu_endstop.tap_wait(tap_end_time)
+    def tap_probing_move(self, moves, tap_count, hold_time):
+        phoming = self.printer.lookup_object('homing')
+        return phoming.tap_probing_move(self, moves, tap_count, hold_time)
     def probe_prepare(self, hmove):
         if self.multi == 'OFF' or self.multi == 'FIRST':
             self._lower_probe()
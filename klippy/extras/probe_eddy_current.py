@@ -3,8 +3,8 @@
 # Copyright (C) 2021-2024  Kevin O'Connor <kevin@koconnor.net>
 #
 # This file may be distributed under the terms of the GNU GPLv3 license.
-import logging, math, bisect
-import mcu
+import logging, math
+import mcu, chelper
 from . import ldc1612, probe, manual_probe
 
 OUT_OF_RANGE = 99.9
@@ -22,6 +22,9 @@ class EddyCalibration:
         # Current calibration data
         self.cal_freqs = []
         self.cal_zpos = []
+        ffi_main, ffi_lib = chelper.get_ffi()
+        self.curve = ffi_main.gc(ffi_lib.eddy_curve_alloc(),
+                                 ffi_lib.eddy_curve_free)
         cal = config.get('calibrate', None)
         if cal is not None:
             cal = [list(map(float, d.strip().split(':', 1)))
@@ -41,45 +44,32 @@ class EddyCalibration:
         cal = sorted([(c[1], c[0]) for c in cal])
         self.cal_freqs = [c[0] for c in cal]
         self.cal_zpos = [c[1] for c in cal]
+        ffi_main, ffi_lib = chelper.get_ffi()
+        ffi_lib.eddy_curve_set(self.curve, len(cal), self.cal_freqs,
+                               self.cal_zpos, OUT_OF_RANGE)
     def apply_calibration(self, samples):
+        count = len(samples)
+        if not count:
+            return
         cur_temp = self.drift_comp.get_temperature()
-        for i, (samp_time, freq, dummy_z) in enumerate(samples):
-            adj_freq = self.drift_comp.adjust_freq(freq, cur_temp)
-            pos = bisect.bisect(self.cal_freqs, adj_freq)
-            if pos >= len(self.cal_zpos):
-                zpos = -OUT_OF_RANGE
-            elif pos == 0:
-                zpos = OUT_OF_RANGE
-            else:
-                # XXX - could further optimize and avoid div by zero
-                this_freq = self.cal_freqs[pos]
-                prev_freq = self.cal_freqs[pos - 1]
-                this_zpos = self.cal_zpos[pos]
-                prev_zpos = self.cal_zpos[pos - 1]
-                gain = (this_zpos - prev_zpos) / (this_freq - prev_freq)
-                offset = prev_zpos - prev_freq * gain
-                zpos = adj_freq * gain + offset
-            samples[i] = (samp_time, freq, round(zpos, 6))
+        freqs = self.drift_comp.adjust_freqs([s[1] for s in samples],
+                                             cur_temp)
+        ffi_main, ffi_lib = chelper.get_ffi()
+        heights = ffi_main.new('double[]', count)
+        ffi_lib.eddy_curve_freq_to_height_batch(self.curve, count, freqs,
+                                                heights)
+        samples[:] = [(s[0], s[1], z) for s, z in zip(samples, heights)]
     def freq_to_height(self, freq):
-        dummy_sample = [(0., freq, 0.)]
-        self.apply_calibration(dummy_sample)
-        return dummy_sample[0][2]
+        ffi_main, ffi_lib = chelper.get_ffi()
+        adj_freq = self.drift_comp.adjust_freq(freq)
+        return ffi_lib.eddy_curve_freq_to_height(self.curve, adj_freq)
     def height_to_freq(self, height):
-        # XXX - could optimize lookup
-        rev_zpos = list(reversed(self.cal_zpos))
-        rev_freqs = list(reversed(self.cal_freqs))
-        pos = bisect.bisect(rev_zpos, height)
-        if pos == 0 or pos >= len(rev_zpos):
+        ffi_main, ffi_lib = chelper.get_ffi()
+        freq = ffi_lib.eddy_curve_height_to_freq(self.curve, height)
+        if freq < 0.:
             self.gcode.run_script_from_command('M117 Tip code: 115')
             raise self.printer.command_error(
                 "Invalid probe_eddy_current height")
-        this_freq = rev_freqs[pos]
-        prev_freq = rev_freqs[pos - 1]
-        this_zpos = rev_zpos[pos]
-        prev_zpos = rev_zpos[pos - 1]
-        gain = (this_freq - prev_freq) / (this_zpos - prev_zpos)
-        offset = prev_freq - prev_zpos * gain
-        freq = height * gain + offset
         return self.drift_comp.unadjust_freq(freq)
     def do_calibration_moves(self, move_speed):
         toolhead = self.printer.lookup_object('toolhead')
@@ -223,6 +213,11 @@ class EddyGatherSamples:
         self._probe_times = []
         self._probe_results = []
         self._need_stop = False
+        # Continuous scan storage
+        self._scan_trapq = None
+        self._scan_start_time = 0.
+        self._scan_last_time = 0.
+        self._scan_samples = []
         self.gcode = self._printer.lookup_object("gcode")
         # Start samples
         if not self._calibration.is_calibrated():
@@ -232,9 +227,39 @@ class EddyGatherSamples:
         if self._need_stop:
             del self._samples[:]
             return False
+        if self._scan_trapq is not None:
+            self._add_scan_samples(msg['data'])
+            return True
         self._samples.append(msg)
         self._check_samples()
         return True
+    def _add_scan_samples(self, data):
+        # Store the sensor height of every sample along with the toolhead
+        # position (from the trapq history) at the time of the sample
+        self._scan_last_time = data[-1][0]
+        data = [d for d in data if d[0] >= self._scan_start_time
+                and abs(d[2]) < OUT_OF_RANGE]
+        if not data:
+            return
+        moves, cdata = self._scan_trapq.extract_trapq(data[0][0], data[-1][0])
+        if not moves:
+            return
+        scan_samples = self._scan_samples
+        move_idx = 0
+        move = moves[0]
+        for samp_time, freq, sensor_z in data:
+            while (move_idx + 1 < len(moves)
+                   and moves[move_idx + 1].print_time <= samp_time):
+                move_idx += 1
+                move = moves[move_idx]
+            move_time = max(0., min(move.move_t, samp_time - move.print_time))
+            dist = (move.start_v + .5 * move.accel * move_time) * move_time
+            # Callers expect position relative to z_offset
+            toolhead_z = move.start_z + move.z_r * dist
+            scan_samples.append(
+                (move.start_x + move.x_r * dist,
+                 move.start_y + move.y_r * dist,
+                 self._z_offset + toolhead_z - sensor_z))
     def finish(self):
         self._need_stop = True
     def _await_samples(self):
@@ -314,6 +339,28 @@ class EddyGatherSamples:
             results.append(toolhead_pos)
         del self._probe_results[:]
         return results
+    def start_scan(self, start_time):
+        motion_report = self._printer.lookup_object('motion_report')
+        self._scan_trapq = motion_report.trapqs['toolhead']
+        self._scan_start_time = start_time
+        del self._scan_samples[:]
+    def pull_scan(self, end_time):
+        # Wait for all samples up to end_time and return (x, y, z) of
+        # every sample taken since start_scan()
+        reactor = self._printer.get_reactor()
+        mcu = self._sensor_helper.get_mcu()
+        while self._scan_last_time < end_time:
+            systime = reactor.monotonic()
+            est_print_time = mcu.estimated_print_time(systime)
+            if est_print_time > end_time + 1.0:
+                self.gcode.run_script_from_command('M117 Tip code: 119')
+                raise self._printer.command_error(
+                    "probe_eddy_current sensor outage")
+            reactor.pause(systime + 0.010)
+        self._scan_trapq = None
+        results = self._scan_samples
+        self._scan_samples = []
+        return results
     def note_probe(self, start_time, end_time, toolhead_pos):
         self._probe_times.append((start_time, end_time, None, toolhead_pos))
         self._check_samples()
@@ -346,6 +393,8 @@ class EddyEndstopWrapper:
         self._dispatch.add_stepper(stepper)
     def get_steppers(self):
         return self._dispatch.get_steppers()
+    def get_trigger_latency(self):
+        return self._dispatch.get_trigger_latency()
     def home_start(self, print_time, sample_time, sample_count, rest_time,
                    triggered=True):
         self._trigger_time = 0.
@@ -443,6 +492,13 @@ class EddyScanningProbe:
         start_time = printtime + self._sample_time_delay
         self._gather.note_probe_and_position(
             start_time, start_time + self._sample_time, start_time)
+    def start_scan(self):
+        # Record every sensor sample from now until pull_scan_samples()
+        toolhead = self._printer.lookup_object("toolhead")
+        self._gather.start_scan(toolhead.get_last_move_time())
+    def pull_scan_samples(self):
+        toolhead = self._printer.lookup_object("toolhead")
+        return self._gather.pull_scan(toolhead.get_last_move_time())
     def pull_probed_results(self):
         if self._is_rapid:
             # Flush lookahead (so all lookahead callbacks are invoked)
@@ -505,6 +561,7 @@ class PrinterEddyProbe:
     def start_probe_session(self, gcmd):
         method = gcmd.get('METHOD', 'automatic').lower()
         if method in ('scan', 'rapid_scan'):
+            self.printer.send_event("probe:session_begin")
             z_offset = self.get_offsets()[2]
             return EddyScanningProbe(self.printer, self.sensor_helper,
                                      self.calibration, z_offset, gcmd)
@@ -556,6 +613,8 @@ class DummyDriftCompensation:
         pass
     def adjust_freq(self, freq, temp=None):
         return freq
+    def adjust_freqs(self, freqs, temp=None):
+        return freqs
     def unadjust_freq(self, freq, temp=None):
         return freq
 
@@ -117,6 +117,7 @@ class PrinterProbePressure:
         except:
             logging.exception("Multi-probe end")
     def multi_probe_begin(self):
+        self.printer.send_event("probe:session_begin")
         self.mcu_probe.multi_probe_begin()
         self.multi_probe_pending = True
     def multi_probe_end(self):
@@ -344,6 +345,7 @@ class ProbeEndstopWrapper:
         self.home_start = self.mcu_endstop.home_start
         self.home_wait = self.mcu_endstop.home_wait
         self.query_endstop = self.mcu_endstop.query_endstop
+        self.get_trigger_latency = self.mcu_endstop.get_trigger_latency
         # multi probes state
         self.multi = 'OFF'
     def _handle_mcu_identify(self):
@@ -401,9 +403,11 @@ class ProbePointsHelper:
         def_move_z = config.getfloat('horizontal_move_z', 5.)
         self.default_horizontal_move_z = def_move_z
         self.speed = config.getfloat('speed', 50., above=0.)
+        self.pipelined = config.getboolean('pipelined_probing', False)
         self.use_offsets = False
         # Internal probing state
         self.lift_speed = self.speed
+        self.retract_dist = 0.
         self.probe_offsets = (0., 0., 0.)
         self.results = []
     def minimum_points(self,n):
@@ -417,8 +421,22 @@ class ProbePointsHelper:
         self.use_offsets = use_offsets
     def get_lift_speed(self):
         return self.lift_speed
-    def _move_next(self):
+    def _move_next(self, pipelined=False):
         toolhead = self.printer.lookup_object('toolhead')
+        if pipelined and 0 < len(self.results) < len(self.probe_points):
+            # Only retract far enough to clear the bed and climb to
+            # horizontal_move_z while travelling to the next point
+            curz = toolhead.get_position()[2]
+            lift_z = min(curz + self.retract_dist, self.horizontal_move_z)
+            if lift_z > curz:
+                toolhead.manual_move([None, None, lift_z], self.lift_speed)
+            nextpos = list(self.probe_points[len(self.results)])
+            if self.use_offsets:
+                nextpos[0] -= self.probe_offsets[0]
+                nextpos[1] -= self.probe_offsets[1]
+            toolhead.manual_move(nextpos + [self.horizontal_move_z],
+                                 self.speed)
+            return False
         # Lift toolhead
         speed = self.lift_speed
         if not self.results:
@@ -456,13 +474,17 @@ class ProbePointsHelper:
             return
         # Perform automatic probing
         self.lift_speed = probe.get_lift_speed(gcmd)
+        self.retract_dist = gcmd.get_float("SAMPLE_RETRACT_DIST",
+                                           probe.sample_retract_dist, above=0.)
         self.probe_offsets = probe.get_offsets()
         if self.horizontal_move_z < self.probe_offsets[2]:
             raise gcmd.error("horizontal_move_z can't be less than"
                              " probe's z_offset")
+        pipelined = gcmd.get_int('PIPELINED', self.pipelined,
+                                 minval=0, maxval=1)
         probe.multi_probe_begin()
         while 1:
-            done = self._move_next()
+            done = self._move_next(pipelined)
             if done:
                 break
             pos = probe.run_probe(gcmd)
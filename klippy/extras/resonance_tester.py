@@ -133,6 +133,14 @@ class ResonanceTester:
             if self.accel_chip_names[0][1] == self.accel_chip_names[1][1]:
                 self.accel_chip_names = [('xy', self.accel_chip_names[0][1])]
         self.max_smoothing = config.getfloat('max_smoothing', None, minval=0.05)
+        # Grid of points for position dependent shaper calibration
+        self.map_min = config.getfloatlist('map_min', None, count=2)
+        self.map_max = config.getfloatlist('map_max', None, count=2)
+        self.map_count = config.getintlist('map_count', (3, 3), count=2)
+        if min(self.map_count) < 1:
+            raise config.error("Option 'map_count' in section '%s' must be"
+                               " at least 1" % (config.get_name(),))
+        self.map_z = config.getfloat('map_z', None)
 
         self.gcode = self.printer.lookup_object('gcode')
         self.gcode.register_command("MEASURE_AXES_NOISE",
@@ -144,6 +152,9 @@ class ResonanceTester:
         self.gcode.register_command("SHAPER_CALIBRATE",
                                     self.cmd_SHAPER_CALIBRATE,
                                     desc=self.cmd_SHAPER_CALIBRATE_help)
+        self.gcode.register_command("SHAPER_MAP_CALIBRATE",
+                                    self.cmd_SHAPER_MAP_CALIBRATE,
+                                    desc=self.cmd_SHAPER_MAP_CALIBRATE_help)
         self.printer.register_event_handler("klippy:connect", self.connect)
 
     def connect(self):
@@ -151,6 +162,13 @@ class ResonanceTester:
                 (chip_axis, self.printer.lookup_object(chip_name))
                 for chip_axis, chip_name in self.accel_chip_names]
 
+    def _start_client(self, chip, helper, keep_msgs):
+        aclient = chip.start_internal_client()
+        if helper is not None:
+            # Calculate the frequency response while the test runs
+            psd_stream = helper.start_psd_stream(aclient.request_start_time)
+            aclient.set_psd_stream(psd_stream, keep_msgs)
+        return aclient
     def _run_test(self, gcmd, axes, helper, raw_name_suffix=None,
                   accel_chips=None, test_point=None):
         toolhead = self.printer.lookup_object('toolhead')
@@ -175,14 +193,16 @@ class ResonanceTester:
                     gcmd.respond_info("Testing axis %s" % axis.get_name())
 
                 raw_values = []
+                keep_msgs = raw_name_suffix is not None
                 if accel_chips is None:
                     for chip_axis, chip in self.accel_chips:
                         if axis.matches(chip_axis):
-                            aclient = chip.start_internal_client()
+                            aclient = self._start_client(chip, helper,
+                                                         keep_msgs)
                             raw_values.append((chip_axis, aclient, chip.name))
                 else:
                     for chip in accel_chips:
-                        aclient = chip.start_internal_client()
+                        aclient = self._start_client(chip, helper, keep_msgs)
                         raw_values.append((axis, aclient, chip.name))
 
                 # Generate moves
@@ -328,6 +348,8 @@ class ResonanceTester:
             if input_shaper is not None:
                 helper.apply_params(input_shaper, axis_name,
                                     best_shaper.name, best_shaper.freq)
+                if input_shaper.has_freq_map(axis_name):
+                    helper.clear_freq_map(configfile, axis_name)
             helper.save_params(configfile, axis_name,
                                best_shaper.name, best_shaper.freq)
             csv_name = self.save_calibration_data(
@@ -338,16 +360,128 @@ class ResonanceTester:
         gcmd.respond_info(
             "The SAVE_CONFIG command will update the printer config file\n"
             "with these parameters and restart the printer.")
+    def _get_map_points(self, gcmd):
+        map_min = gcmd.get("MAP_MIN", None)
+        map_max = gcmd.get("MAP_MAX", None)
+        map_count = gcmd.get("MAP_COUNT", None)
+        def parse(value, default, name, parser=float):
+            if value is None:
+                if default is None:
+                    raise gcmd.error("%s must be specified" % (name,))
+                return list(default)
+            try:
+                res = [parser(v.strip()) for v in value.split(',')]
+            except ValueError:
+                res = []
+            if len(res) != 2:
+                raise gcmd.error("Invalid %s parameter '%s'" % (name, value))
+            return res
+        map_min = parse(map_min, self.map_min, "MAP_MIN")
+        map_max = parse(map_max, self.map_max, "MAP_MAX")
+        map_count = parse(map_count, self.map_count, "MAP_COUNT", int)
+        if (min(map_count) < 1 or map_max[0] < map_min[0]
+                or map_max[1] < map_min[1]):
+            raise gcmd.error("Invalid shaper map parameters")
+        z = gcmd.get_float("Z", self.map_z)
+        if z is None:
+            z = self.test.get_start_test_points()[0][2]
+        def get_coords(i):
+            if map_count[i] == 1:
+                return [.5 * (map_min[i] + map_max[i])]
+            step = (map_max[i] - map_min[i]) / (map_count[i] - 1)
+            return [map_min[i] + j * step for j in range(map_count[i])]
+        if map_count[0] == 1:
+            map_min[0] = map_max[0] = get_coords(0)[0]
+        if map_count[1] == 1:
+            map_min[1] = map_max[1] = get_coords(1)[0]
+        points = [(x, y, z) for y in get_coords(1) for x in get_coords(0)]
+        return points, map_min, map_max, map_count
+    cmd_SHAPER_MAP_CALIBRATE_help = (
+        "Calibrate the input shaper frequency at a grid of positions")
+    def cmd_SHAPER_MAP_CALIBRATE(self, gcmd):
+        # Parse parameters
+        axis = gcmd.get("AXIS", None)
+        if not axis:
+            calibrate_axes = [TestAxis('x'), TestAxis('y')]
+        elif axis.lower() not in 'xy':
+            raise gcmd.error("Unsupported axis '%s'" % (axis,))
+        else:
+            calibrate_axes = [TestAxis(axis.lower())]
+        chips_str = gcmd.get("CHIPS", None)
+        accel_chips = self._parse_chips(chips_str) if chips_str else None
+        max_smoothing = gcmd.get_float(
+                "MAX_SMOOTHING", self.max_smoothing, minval=0.05)
+        points, map_min, map_max, map_count = self._get_map_points(gcmd)
+
+        input_shaper = self.printer.lookup_object('input_shaper', None)
+        helper = shaper_calibrate.ShaperCalibrate(self.printer)
+
+        # Measure the resonances at each point of the grid
+        point_data = {axis: [] for axis in calibrate_axes}
+        for point in points:
+            calibration_data = self._run_test(gcmd, calibrate_axes, helper,
+                                              accel_chips=accel_chips,
+                                              test_point=point)
+            for axis in calibrate_axes:
+                calibration_data[axis].normalize_to_frequencies()
+                point_data[axis].append(calibration_data[axis])
+
+        configfile = self.printer.lookup_object('configfile')
+        systime = self.printer.get_reactor().monotonic()
+        toolhead = self.printer.lookup_object('toolhead')
+        scv = toolhead.get_status(systime)['square_corner_velocity']
+        max_freq = self._get_max_calibration_freq()
+        for axis in calibrate_axes:
+            axis_name = axis.get_name()
+            gcmd.respond_info(
+                    "Calculating the input shaper frequency map for %s axis"
+                    % (axis_name,))
+            # Select the shaper type from the combined measurements
+            combined = point_data[axis][0].copy()
+            for data in point_data[axis][1:]:
+                combined.add_data(data)
+            best_shaper, all_shapers = helper.find_best_shaper(
+                    combined, max_smoothing=max_smoothing, scv=scv,
+                    max_freq=max_freq)
+            # Fit the frequency of that shaper at each point
+            fitted = helper.fit_shaper_map(best_shaper.name, point_data[axis],
+                                           scv=scv,
+                                           max_smoothing=max_smoothing,
+                                           max_freq=max_freq)
+            freqs = [round(shaper.freq, 1) for shaper in fitted]
+            freq_map = [freqs[i:i+map_count[0]]
+                        for i in range(0, len(freqs), map_count[0])]
+            for point, shaper in zip(points, fitted):
+                gcmd.respond_info(
+                        "Point (%.1f, %.1f): shaper_freq_%s = %.1f Hz"
+                        " (vibrations = %.1f%%, smoothing ~= %.3f)" % (
+                            point[0], point[1], axis_name, shaper.freq,
+                            shaper.vibrs * 100., shaper.smoothing))
+            gcmd.respond_info(
+                    "Recommended shaper_type_%s = %s, shaper_freq_%s ="
+                    " %.1f-%.1f Hz" % (axis_name, best_shaper.name,
+                                       axis_name, min(freqs), max(freqs)))
+            if input_shaper is not None:
+                input_shaper.set_freq_map(axis_name, best_shaper.name,
+                                          best_shaper.freq, freq_map,
+                                          map_min, map_max)
+            helper.save_params(configfile, axis_name,
+                               best_shaper.name, best_shaper.freq)
+            helper.save_freq_map(configfile, axis_name, freq_map,
+                                 map_min, map_max)
+        gcmd.respond_info(
+            "The SAVE_CONFIG command will update the printer config file\n"
+            "with these parameters and restart the printer.")
     cmd_MEASURE_AXES_NOISE_help = (
         "Measures noise of all enabled accelerometer chips")
     def cmd_MEASURE_AXES_NOISE(self, gcmd):
         meas_time = gcmd.get_float("MEAS_TIME", 2.)
-        raw_values = [(chip_axis, chip.start_internal_client())
+        helper = shaper_calibrate.ShaperCalibrate(self.printer)
+        raw_values = [(chip_axis, self._start_client(chip, helper, False))
                       for chip_axis, chip in self.accel_chips]
         self.printer.lookup_object('toolhead').dwell(meas_time)
         for chip_axis, aclient in raw_values:
             aclient.finish_measurements()
-        helper = shaper_calibrate.ShaperCalibrate(self.printer)
         for chip_axis, aclient in raw_values:
             if not aclient.has_valid_samples():
                 raise gcmd.error(
@@ -12,6 +12,8 @@ WINDOW_T_SEC = 0.5
 MAX_SHAPER_FREQ = 150.
 
 TEST_DAMPING_RATIOS=[0.075, 0.1, 0.15]
+# Number of test frequencies evaluated at once when fitting a shaper
+FIT_CHUNK_SIZE = 128
 
 AUTOTUNE_SHAPERS = ['zv', 'mzv', 'ei', '2hump_ei', '3hump_ei']
 ######################################################################
@@ -42,6 +44,13 @@ class CalibrationData:
         self.data_sets = joined_data_sets
     def set_numpy(self, numpy):
         self.numpy = numpy
+    def copy(self):
+        data = CalibrationData(self.freq_bins, self.psd_sum.copy(),
+                               self.psd_x.copy(), self.psd_y.copy(),
+                               self.psd_z.copy())
+        data.set_numpy(self.numpy)
+        data.data_sets = self.data_sets
+        return data
     def normalize_to_frequencies(self):
         for psd in self._psd_list:
             # Avoid division by zero errors
@@ -52,6 +61,81 @@ class CalibrationData:
         return self._psd_map[axis]
 
 
+# Round up to the nearest power of 2 for faster FFT
+def calc_nfft(sampling_freq):
+    return 1 << int(sampling_freq * WINDOW_T_SEC - 1).bit_length()
+
+# Incremental Welch PSD calculation of accelerometer samples.  Windows
+# are processed as soon as their samples arrive, so only the samples
+# of the last window need to be stored.
+class PSDStream:
+    def __init__(self, helper, start_time):
+        self.helper = helper
+        self.numpy = np = helper.numpy
+        self.start_time = start_time
+        self.end_time = float('inf')
+        self.first_time = self.last_time = 0.
+        self.sample_count = 0
+        self.pending = np.zeros((0, 3))
+        self.nfft = self.window = None
+        self.psd_sums = [0., 0., 0.]
+        self.n_windows = 0
+    def set_end_time(self, end_time):
+        self.end_time = end_time
+    def has_samples(self):
+        return self.sample_count > 0
+    def _get_sampling_freq(self):
+        return self.sample_count / (self.last_time - self.first_time)
+    def add_samples(self, samples):
+        np = self.numpy
+        data = np.array(samples, dtype=float).reshape(-1, 4)
+        times = data[:,0]
+        data = data[(times >= self.start_time) & (times <= self.end_time)]
+        if not data.shape[0]:
+            return
+        if not self.sample_count:
+            self.first_time = data[0,0]
+        self.last_time = data[-1,0]
+        self.sample_count += data.shape[0]
+        self.pending = np.concatenate((self.pending, data[:,1:]))
+        if (self.nfft is None
+            and self.last_time - self.first_time >= 2. * WINDOW_T_SEC):
+            self._set_nfft()
+        if self.nfft is not None:
+            self._process_windows()
+    def _set_nfft(self):
+        self.nfft = calc_nfft(self._get_sampling_freq())
+        self.window = self.helper._psd_window(self.nfft)
+    def _process_windows(self):
+        nfft = self.nfft
+        step = nfft - nfft // 2
+        n_windows = (self.pending.shape[0] - nfft // 2) // step
+        if n_windows <= 0:
+            return
+        pending = self.numpy.ascontiguousarray(self.pending.T)
+        for i in range(3):
+            psd_sum, count = self.helper._psd_windows(pending[i], nfft,
+                                                      self.window)
+            self.psd_sums[i] += psd_sum
+        self.n_windows += n_windows
+        self.pending = self.pending[n_windows * step:]
+    def get_calibration_data(self):
+        if self.sample_count < 2 or self.last_time <= self.first_time:
+            return None
+        if self.nfft is None:
+            self._set_nfft()
+            self._process_windows()
+        if not self.n_windows:
+            return None
+        fs = self._get_sampling_freq()
+        psds = [self.helper._psd_finalize(psd_sum, self.n_windows, fs,
+                                          self.nfft, self.window)
+                for psd_sum in self.psd_sums]
+        freqs = psds[0][0]
+        px, py, pz = [psd for f, psd in psds]
+        return CalibrationData(freqs, px+py+pz, px, py, pz)
+
+
 CalibrationResult = collections.namedtuple(
         'CalibrationResult',
         ('name', 'freq', 'vals', 'vibrs', 'smoothing', 'score', 'max_accel'))
@@ -69,40 +153,70 @@ class ShaperCalibrate:
                     "docs/Measuring_Resonances.md for more details).")
 
     def background_process_exec(self, method, args):
+        return self.background_process_exec_multi(method, [args])[0]
+
+    def background_process_exec_multi(self, method, args_list):
+        # Run method() with each of the args in args_list, using up to
+        # one process per cpu, and return the list of results
         if self.printer is None:
-            return method(*args)
+            return [method(*args) for args in args_list]
         import queuelogger
-        parent_conn, child_conn = multiprocessing.Pipe()
-        def wrapper():
-            queuelogger.clear_bg_logging()
-            try:
-                res = method(*args)
-            except:
-                child_conn.send((True, traceback.format_exc()))
+        def start_process(args):
+            parent_conn, child_conn = multiprocessing.Pipe()
+            def wrapper():
+                queuelogger.clear_bg_logging()
+                try:
+                    res = method(*args)
+                except:
+                    child_conn.send((True, traceback.format_exc()))
+                    child_conn.close()
+                    return
+                child_conn.send((False, res))
                 child_conn.close()
-                return
-            child_conn.send((False, res))
-            child_conn.close()
-        # Start a process to perform the calculation
-        calc_proc = multiprocessing.Process(target=wrapper)
-        calc_proc.daemon = True
-        calc_proc.start()
-        # Wait for the process to finish
+            # Start a process to perform the calculation
+            calc_proc = multiprocessing.Process(target=wrapper)
+            calc_proc.daemon = True
+            calc_proc.start()
+            return calc_proc, parent_conn
+        try:
+            max_procs = multiprocessing.cpu_count()
+        except NotImplementedError:
+            max_procs = 1
+        results = [None] * len(args_list)
+        pending = list(enumerate(args_list))
+        running = []
+        # Wait for the processes to finish
         reactor = self.printer.get_reactor()
         gcode = self.printer.lookup_object("gcode")
         eventtime = last_report_time = reactor.monotonic()
-        while calc_proc.is_alive():
+        while pending or running:
+            while pending and len(running) < max_procs:
+                idx, args = pending.pop(0)
+                running.append((idx,) + start_process(args))
+            for proc_info in list(running):
+                idx, calc_proc, parent_conn = proc_info
+                if not parent_conn.poll():
+                    if calc_proc.is_alive():
+                        continue
+                    is_err, res = True, "process exited unexpectedly"
+                else:
+                    is_err, res = parent_conn.recv()
+                calc_proc.join()
+                parent_conn.close()
+                running.remove(proc_info)
+                if is_err:
+                    for idx, calc_proc, parent_conn in running:
+                        calc_proc.terminate()
+                    raise self.error("Error in remote calculation: %s"
+                                     % (res,))
+                results[idx] = res
+            if not pending and not running:
+                break
             if eventtime > last_report_time + 5.:
                 last_report_time = eventtime
                 gcode.respond_info("Wait for calculations..", log=False)
             eventtime = reactor.pause(eventtime + .1)
-        # Return results
-        is_err, res = parent_conn.recv()
-        if is_err:
-            raise self.error("Error in remote calculation: %s" % (res,))
-        calc_proc.join()
-        parent_conn.close()
-        return res
+        return results
 
     def _split_into_windows(self, x, window_size, overlap):
         # Memory-efficient algorithm to split an input 'x' into a series
@@ -114,14 +228,12 @@ class ShaperCalibrate:
         return self.numpy.lib.stride_tricks.as_strided(
                 x, shape=shape, strides=strides, writeable=False)
 
-    def _psd(self, x, fs, nfft):
-        # Calculate power spectral density (PSD) using Welch's algorithm
-        np = self.numpy
-        window = np.kaiser(nfft, 6.)
-        # Compensation for windowing loss
-        scale = 1.0 / (window**2).sum()
+    def _psd_window(self, nfft):
+        return self.numpy.kaiser(nfft, 6.)
 
-        # Split into overlapping windows of size nfft
+    def _psd_windows(self, x, nfft, window):
+        # Sum the frequency response of overlapping windows of size nfft
+        np = self.numpy
         overlap = nfft // 2
         x = self._split_into_windows(x, nfft, overlap)
 
@@ -131,19 +243,29 @@ class ShaperCalibrate:
         # Calculate frequency response for each window using FFT
         result = np.fft.rfft(x, n=nfft, axis=0)
         result = np.conjugate(result) * result
-        result *= scale / fs
+        return result.real.sum(axis=-1), x.shape[-1]
+
+    def _psd_finalize(self, psd_sum, n_windows, fs, nfft, window):
+        np = self.numpy
+        # Welch's algorithm: average response over windows, with
+        # compensation for windowing loss
+        scale = 1.0 / (window**2).sum()
+        psd = psd_sum * (scale / (fs * n_windows))
         # For one-sided FFT output the response must be doubled, except
         # the last point for unpaired Nyquist frequency (assuming even nfft)
         # and the 'DC' term (0 Hz)
-        result[1:-1,:] *= 2.
-
-        # Welch's algorithm: average response over windows
-        psd = result.real.mean(axis=-1)
+        psd[1:-1] *= 2.
 
         # Calculate the frequency bins
         freqs = np.fft.rfftfreq(nfft, 1. / fs)
         return freqs, psd
 
+    def _psd(self, x, fs, nfft):
+        # Calculate power spectral density (PSD) using Welch's algorithm
+        window = self._psd_window(nfft)
+        psd_sum, n_windows = self._psd_windows(x, nfft, window)
+        return self._psd_finalize(psd_sum, n_windows, fs, nfft, window)
+
     def calc_freq_response(self, raw_values):
         np = self.numpy
         if raw_values is None:
@@ -159,8 +281,7 @@ class ShaperCalibrate:
         N = data.shape[0]
         T = data[-1,0] - data[0,0]
         SAMPLING_FREQ = N / T
-        # Round up to the nearest power of 2 for faster FFT
-        M = 1 << int(SAMPLING_FREQ * WINDOW_T_SEC - 1).bit_length()
+        M = calc_nfft(SAMPLING_FREQ)
         if N <= M:
             return None
 
@@ -171,60 +292,94 @@ class ShaperCalibrate:
         fz, pz = self._psd(data[:,3], SAMPLING_FREQ, M)
         return CalibrationData(fx, px+py+pz, px, py, pz)
 
+    def start_psd_stream(self, start_time):
+        return PSDStream(self, start_time)
+
     def process_accelerometer_data(self, data):
-        calibration_data = self.background_process_exec(
-                self.calc_freq_response, (data,))
+        psd_stream = getattr(data, 'psd_stream', None)
+        if psd_stream is not None:
+            # Frequency response was calculated while collecting samples
+            calibration_data = psd_stream.get_calibration_data()
+        else:
+            calibration_data = self.background_process_exec(
+                    self.calc_freq_response, (data,))
         if calibration_data is None:
             raise self.error(
                     "Internal error processing accelerometer data %s" % (data,))
         calibration_data.set_numpy(self.numpy)
         return calibration_data
 
-    def _estimate_shaper(self, shaper, test_damping_ratio, test_freqs):
+    def _estimate_shapers(self, A, T, test_damping_ratio, test_freqs):
+        # Response of a set of shapers (one per row of A and T) at each
+        # of the test_freqs
         np = self.numpy
 
-        A, T = np.array(shaper[0]), np.array(shaper[1])
-        inv_D = 1. / A.sum()
+        inv_D = 1. / A.sum(axis=-1)
 
         omega = 2. * math.pi * test_freqs
         damping = test_damping_ratio * omega
         omega_d = omega * math.sqrt(1. - test_damping_ratio**2)
-        W = A * np.exp(np.outer(-damping, (T[-1] - T)))
-        S = W * np.sin(np.outer(omega_d, T))
-        C = W * np.cos(np.outer(omega_d, T))
-        return np.sqrt(S.sum(axis=1)**2 + C.sum(axis=1)**2) * inv_D
+        W = A[:,None,:] * np.exp(-damping[None,:,None]
+                                 * (T[:,-1:] - T)[:,None,:])
+        S = (W * np.sin(omega_d[None,:,None] * T[:,None,:])).sum(axis=-1)
+        C = (W * np.cos(omega_d[None,:,None] * T[:,None,:])).sum(axis=-1)
+        return np.sqrt(S**2 + C**2) * inv_D[:,None]
 
-    def _estimate_remaining_vibrations(self, shaper, test_damping_ratio,
+    def _estimate_shaper(self, shaper, test_damping_ratio, test_freqs):
+        np = self.numpy
+        A, T = np.array([shaper[0]]), np.array([shaper[1]])
+        return self._estimate_shapers(A, T, test_damping_ratio, test_freqs)[0]
+
+    def _estimate_remaining_vibrations(self, A, T, test_damping_ratio,
                                        freq_bins, psd):
-        vals = self._estimate_shaper(shaper, test_damping_ratio, freq_bins)
+        np = self.numpy
+        vals = self._estimate_shapers(A, T, test_damping_ratio, freq_bins)
         # The input shaper can only reduce the amplitude of vibrations by
         # SHAPER_VIBRATION_REDUCTION times, so all vibrations below that
         # threshold can be igonred
         vibr_threshold = psd.max() / shaper_defs.SHAPER_VIBRATION_REDUCTION
-        remaining_vibrations = self.numpy.maximum(
-                vals * psd - vibr_threshold, 0).sum()
-        all_vibrations = self.numpy.maximum(psd - vibr_threshold, 0).sum()
+        remaining_vibrations = np.maximum(
+                vals * psd - vibr_threshold, 0).sum(axis=-1)
+        all_vibrations = np.maximum(psd - vibr_threshold, 0).sum()
         return (remaining_vibrations / all_vibrations, vals)
 
+    def _get_smoothing_coeffs(self, A, T, scv):
+        # The smoothing of a shaper is max(c90 + k90 * accel, k180 * accel)
+        # (the offsets for 90 and 180 degrees turns).  Returns the
+        # c90, k90, and k180 coefficients of each shaper (row of A and T).
+        np = self.numpy
+        inv_D = 1. / A.sum(axis=-1)
+        # Calculate input shaper shift
+        ts = (A * T).sum(axis=-1) * inv_D
+        dt = T - ts[:,None]
+        # Calculate offset for one of the axes
+        A_90 = A * (dt >= 0.)
+        c90 = (A_90 * scv * dt).sum(axis=-1) * inv_D * math.sqrt(2.)
+        k90 = (A_90 * .5 * dt**2).sum(axis=-1) * inv_D * math.sqrt(2.)
+        k180 = (A * .5 * dt**2).sum(axis=-1) * inv_D
+        return c90, k90, k180
+
     def _get_shaper_smoothing(self, shaper, accel=5000, scv=5.):
-        half_accel = accel * .5
+        np = self.numpy
+        A, T = np.array([shaper[0]]), np.array([shaper[1]])
+        c90, k90, k180 = self._get_smoothing_coeffs(A, T, scv)
+        return float(max(c90[0] + k90[0] * accel, k180[0] * accel))
 
-        A, T = shaper
-        inv_D = 1. / sum(A)
-        n = len(T)
-        # Calculate input shaper shift
-        ts = sum([A[i] * T[i] for i in range(n)]) * inv_D
-
-        # Calculate offset for 90 and 180 degrees turn
-        offset_90 = offset_180 = 0.
-        for i in range(n):
-            if T[i] >= ts:
-                # Calculate offset for one of the axes
-                offset_90 += A[i] * (scv + half_accel * (T[i]-ts)) * (T[i]-ts)
-            offset_180 += A[i] * half_accel * (T[i]-ts)**2
-        offset_90 *= inv_D * math.sqrt(2.)
-        offset_180 *= inv_D
-        return max(offset_90, offset_180)
+    def _calc_max_accel(self, c90, k90, k180):
+        # Just some empirically chosen value which produces good projections
+        # for max_accel without much smoothing
+        TARGET_SMOOTHING = 0.12
+        np = self.numpy
+        with np.errstate(divide='ignore'):
+            max_accel = np.minimum((TARGET_SMOOTHING - c90) / k90,
+                                   TARGET_SMOOTHING / k180)
+        return np.where(c90 > TARGET_SMOOTHING, 0., max_accel)
+
+    def find_shaper_max_accel(self, shaper, scv):
+        np = self.numpy
+        A, T = np.array([shaper[0]]), np.array([shaper[1]])
+        max_accel = self._calc_max_accel(*self._get_smoothing_coeffs(A, T, scv))
+        return float(max_accel[0])
 
     def fit_shaper(self, shaper_cfg, calibration_data, shaper_freqs,
                    damping_ratio, scv, max_smoothing, test_damping_ratios,
@@ -251,70 +406,62 @@ class ShaperCalibrate:
         psd = calibration_data.psd_sum[freq_bins <= max_freq]
         freq_bins = freq_bins[freq_bins <= max_freq]
 
-        best_res = None
-        results = []
-        for test_freq in test_freqs[::-1]:
-            shaper_vibrations = 0.
-            shaper_vals = np.zeros(shape=freq_bins.shape)
-            shaper = shaper_cfg.init_func(test_freq, damping_ratio)
-            shaper_smoothing = self._get_shaper_smoothing(shaper, scv=scv)
-            if max_smoothing and shaper_smoothing > max_smoothing and best_res:
-                return best_res
-            # Exact damping ratio of the printer is unknown, pessimizing
-            # remaining vibrations over possible damping values
-            for dr in test_damping_ratios:
+        # Evaluate all test frequencies at once, from the highest
+        test_freqs = test_freqs[::-1]
+        shapers = [shaper_cfg.init_func(test_freq, damping_ratio)
+                   for test_freq in test_freqs]
+        A = np.array([shaper[0] for shaper in shapers])
+        T = np.array([shaper[1] for shaper in shapers])
+        c90, k90, k180 = self._get_smoothing_coeffs(A, T, scv)
+        shaper_smoothing = np.maximum(c90 + k90 * 5000., k180 * 5000.)
+        # Frequencies with too much smoothing are not considered (once
+        # at least one frequency was evaluated)
+        count = len(test_freqs)
+        too_smooth = False
+        if max_smoothing:
+            over = np.nonzero(shaper_smoothing[1:] > max_smoothing)[0]
+            if len(over):
+                count = over[0] + 1
+                too_smooth = True
+        shaper_vibrations = np.zeros(count)
+        shaper_vals = np.zeros(shape=(count, len(freq_bins)))
+        # Exact damping ratio of the printer is unknown, pessimizing
+        # remaining vibrations over possible damping values
+        for dr in test_damping_ratios:
+            for i in range(0, count, FIT_CHUNK_SIZE):
+                j = min(i + FIT_CHUNK_SIZE, count)
                 vibrations, vals = self._estimate_remaining_vibrations(
-                        shaper, dr, freq_bins, psd)
-                shaper_vals = np.maximum(shaper_vals, vals)
-                if vibrations > shaper_vibrations:
-                    shaper_vibrations = vibrations
-            max_accel = self.find_shaper_max_accel(shaper, scv)
-            # The score trying to minimize vibrations, but also accounting
-            # the growth of smoothing. The formula itself does not have any
-            # special meaning, it simply shows good results on real user data
-            shaper_score = shaper_smoothing * (shaper_vibrations**1.5 +
-                                               shaper_vibrations * .2 + .01)
-            results.append(
-                    CalibrationResult(
-                        name=shaper_cfg.name, freq=test_freq, vals=shaper_vals,
-                        vibrs=shaper_vibrations, smoothing=shaper_smoothing,
-                        score=shaper_score, max_accel=max_accel))
-            if best_res is None or best_res.vibrs > results[-1].vibrs:
-                # The current frequency is better for the shaper.
-                best_res = results[-1]
+                        A[i:j], T[i:j], dr, freq_bins, psd)
+                shaper_vals[i:j] = np.maximum(shaper_vals[i:j], vals)
+                shaper_vibrations[i:j] = np.maximum(
+                        shaper_vibrations[i:j], vibrations)
+        max_accel = self._calc_max_accel(c90, k90, k180)
+        shaper_smoothing = shaper_smoothing[:count]
+        # The score trying to minimize vibrations, but also accounting
+        # the growth of smoothing. The formula itself does not have any
+        # special meaning, it simply shows good results on real user data
+        shaper_score = shaper_smoothing * (shaper_vibrations**1.5 +
+                                           shaper_vibrations * .2 + .01)
+        def get_result(i):
+            # Report plain floats (not numpy scalars) in the results
+            return CalibrationResult(
+                    name=shaper_cfg.name, freq=float(test_freqs[i]),
+                    vals=shaper_vals[i], vibrs=float(shaper_vibrations[i]),
+                    smoothing=float(shaper_smoothing[i]),
+                    score=float(shaper_score[i]),
+                    max_accel=float(max_accel[i]))
+        # The best frequency for the shaper (the highest one on ties)
+        best_idx = int(np.argmin(shaper_vibrations))
+        if too_smooth:
+            return get_result(best_idx)
         # Try to find an 'optimal' shapper configuration: the one that is not
         # much worse than the 'best' one, but gives much less smoothing
-        selected = best_res
-        for res in results[::-1]:
-            if res.vibrs < best_res.vibrs * 1.1 and res.score < selected.score:
-                selected = res
-        return selected
-
-    def _bisect(self, func):
-        left = right = 1.
-        if not func(1e-9):
-            return 0.
-        while not func(left):
-            right = left
-            left *= .5
-        if right == left:
-            while func(right):
-                right *= 2.
-        while right - left > 1e-8:
-            middle = (left + right) * .5
-            if func(middle):
-                left = middle
-            else:
-                right = middle
-        return left
-
-    def find_shaper_max_accel(self, shaper, scv):
-        # Just some empirically chosen value which produces good projections
-        # for max_accel without much smoothing
-        TARGET_SMOOTHING = 0.12
-        max_accel = self._bisect(lambda test_accel: self._get_shaper_smoothing(
-            shaper, test_accel, scv) <= TARGET_SMOOTHING)
-        return max_accel
+        selected = best_idx
+        for i in range(count - 1, -1, -1):
+            if (shaper_vibrations[i] < shaper_vibrations[best_idx] * 1.1
+                    and shaper_score[i] < shaper_score[selected]):
+                selected = i
+        return get_result(selected)
 
     def find_best_shaper(self, calibration_data, shapers=None,
                          damping_ratio=None, scv=None, shaper_freqs=None,
@@ -323,12 +470,15 @@ class ShaperCalibrate:
         best_shaper = None
         all_shapers = []
         shapers = shapers or AUTOTUNE_SHAPERS
-        for shaper_cfg in shaper_defs.INPUT_SHAPERS:
-            if shaper_cfg.name not in shapers:
-                continue
-            shaper = self.background_process_exec(self.fit_shaper, (
-                shaper_cfg, calibration_data, shaper_freqs, damping_ratio,
-                scv, max_smoothing, test_damping_ratios, max_freq))
+        # Fit all shaper types in parallel
+        fit_args = [(shaper_cfg, calibration_data, shaper_freqs,
+                     damping_ratio, scv, max_smoothing, test_damping_ratios,
+                     max_freq)
+                    for shaper_cfg in shaper_defs.INPUT_SHAPERS
+                    if shaper_cfg.name in shapers]
+        fitted = self.background_process_exec_multi(self.fit_shaper,
+                                                    fit_args)
+        for shaper in fitted:
             if logger is not None:
                 logger("Fitted shaper '%s' frequency = %.1f Hz "
                        "(vibrations = %.1f%%, smoothing ~= %.3f)" % (
@@ -346,6 +496,16 @@ class ShaperCalibrate:
                 best_shaper = shaper
         return best_shaper, all_shapers
 
+    def fit_shaper_map(self, shaper_name, calibration_data_list,
+                       scv=None, max_smoothing=None, max_freq=None):
+        # Fit the frequency of one shaper type for each measured point
+        shaper_cfg = [cfg for cfg in shaper_defs.INPUT_SHAPERS
+                      if cfg.name == shaper_name][0]
+        fit_args = [(shaper_cfg, calibration_data, None, None, scv,
+                     max_smoothing, None, max_freq)
+                    for calibration_data in calibration_data_list]
+        return self.background_process_exec_multi(self.fit_shaper, fit_args)
+
     def save_params(self, configfile, axis, shaper_name, shaper_freq):
         if axis == 'xy':
             self.save_params(configfile, 'x', shaper_name, shaper_freq)
@@ -355,6 +515,23 @@ class ShaperCalibrate:
             configfile.set('input_shaper', 'shaper_freq_'+axis,
                            '%.1f' % (shaper_freq,))
 
+    def save_freq_map(self, configfile, axis, freq_map, map_min, map_max):
+        freqs = ""
+        for row in freq_map:
+            freqs += "\n  " + ", ".join(["%.1f" % (f,) for f in row])
+        configfile.set('input_shaper', 'shaper_map_min',
+                       '%.3f, %.3f' % tuple(map_min))
+        configfile.set('input_shaper', 'shaper_map_max',
+                       '%.3f, %.3f' % tuple(map_max))
+        configfile.set('input_shaper', 'shaper_freq_map_' + axis, freqs)
+
+    def clear_freq_map(self, configfile, axis):
+        if axis == 'xy':
+            self.clear_freq_map(configfile, 'x')
+            self.clear_freq_map(configfile, 'y')
+        else:
+            configfile.set('input_shaper', 'shaper_freq_map_' + axis, '')
+
     def apply_params(self, input_shaper, axis, shaper_name, shaper_freq):
         if axis == 'xy':
             self.apply_params(input_shaper, 'x', shaper_name, shaper_freq)
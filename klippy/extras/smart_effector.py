@@ -62,6 +62,7 @@ class SmartEffectorProbe:
         self.home_start = self.probe_wrapper.home_start
         self.home_wait = self.probe_wrapper.home_wait
         self.query_endstop = self.probe_wrapper.query_endstop
+        self.get_trigger_latency = self.probe_wrapper.get_trigger_latency
         self.multi_probe_begin = self.probe_wrapper.multi_probe_begin
         self.multi_probe_end = self.probe_wrapper.multi_probe_end
         self.get_position_endstop = self.probe_wrapper.get_position_endstop
@@ -4,6 +4,7 @@
 #
 # This file may be distributed under the terms of the GNU GPLv3 license.
 import logging
+import chelper
 from . import manual_probe
 
 KELVIN_TO_CELSIUS = -273.15
@@ -481,6 +482,17 @@ class TemperatureProbe:
 #####################################################################
 
 DRIFT_SAMPLE_COUNT = 9
+DRIFT_TABLE_MAX_TEMP = 150.
+DRIFT_TABLE_STEP = .5
+
+# Sample each drift curve at regular temperature intervals (from 0C up
+# to max_temp) so that corrections can be interpolated from a table.
+# Returns the number of rows and the table (row by row).
+def sample_drift_curves(curves, max_temp):
+    temp_count = int(max_temp / DRIFT_TABLE_STEP + .5) + 1
+    table = [poly(i * DRIFT_TABLE_STEP)
+             for i in range(temp_count) for poly in curves]
+    return temp_count, table
 
 class EddyDriftCompensation:
     def __init__(self, config, sensor):
@@ -496,6 +508,9 @@ class EddyDriftCompensation:
             "drift_calibration", None, seps=(',', '\n'), parser=float
         )
         self.min_freq = 999999999999.
+        ffi_main, ffi_lib = chelper.get_ffi()
+        self.drift_table = ffi_main.gc(ffi_lib.eddy_drift_alloc(),
+                                       ffi_lib.eddy_drift_free)
         if dc is not None:
             for coefs in dc:
                 if len(coefs) != 3:
@@ -508,6 +523,7 @@ class EddyDriftCompensation:
             self._check_calibration(cal, start_temp, end_temp, config.error)
             low_poly = self.drift_calibration[-1]
             self.min_freq = min([low_poly(temp) for temp in range(121)])
+            self._build_drift_table()
             cal_str = "\n".join([repr(p) for p in cal])
             logging.info(
                 "%s: loaded temperature drift calibration. Min Temp: %.2f,"
@@ -677,6 +693,25 @@ class EddyDriftCompensation:
                     )
                 last_freq = next_freq
 
+    def _build_drift_table(self):
+        max_temp = max(DRIFT_TABLE_MAX_TEMP, self.max_valid_temp)
+        dc = self.drift_calibration
+        temp_count, table = sample_drift_curves(dc, max_temp)
+        ffi_main, ffi_lib = chelper.get_ffi()
+        ffi_lib.eddy_drift_set_table(self.drift_table, len(dc), temp_count,
+                                     table, 0., DRIFT_TABLE_STEP,
+                                     self.min_freq)
+
+    def calc_freqs(self, freqs, origin_temp, dest_temp):
+        # Convert a list of frequencies sampled at origin_temp to the
+        # frequencies the sensor would report at dest_temp
+        count = len(freqs)
+        ffi_main, ffi_lib = chelper.get_ffi()
+        out = ffi_main.new('double[]', count)
+        ffi_lib.eddy_drift_calc_freqs(self.drift_table, count, freqs, out,
+                                      origin_temp, dest_temp)
+        return out
+
     def adjust_freq(self, freq, origin_temp=None):
         # Adjusts frequency from current temperature toward
         # destination temperature
@@ -684,7 +719,15 @@ class EddyDriftCompensation:
             return freq
         if origin_temp is None:
             origin_temp = self.get_temperature()
-        return self._calc_freq(freq, origin_temp, self.cal_temp)
+        return self.calc_freqs([freq], origin_temp, self.cal_temp)[0]
+
+    def adjust_freqs(self, freqs, origin_temp=None):
+        # Adjust a list of frequencies sampled at the same temperature
+        if not self.enabled:
+            return freqs
+        if origin_temp is None:
+            origin_temp = self.get_temperature()
+        return self.calc_freqs(freqs, origin_temp, self.cal_temp)
 
     def unadjust_freq(self, freq, dest_temp=None):
         # Given a frequency and its orignal sampled temp, find the
@@ -693,25 +736,7 @@ class EddyDriftCompensation:
             return freq
         if dest_temp is None:
             dest_temp = self.get_temperature()
-        return self._calc_freq(freq, self.cal_temp, dest_temp)
-
-    def _calc_freq(self, freq, origin_temp, dest_temp):
-        high_freq = low_freq = None
-        dc = self.drift_calibration
-        for pos, poly in enumerate(dc):
-            high_freq = low_freq
-            low_freq = poly(origin_temp)
-            if freq >= low_freq:
-                if high_freq is None:
-                    # Freqency above max calibration value
-                    err = poly(dest_temp) - low_freq
-                    return freq + err
-                t = min(1., max(0., (freq - low_freq) / (high_freq - low_freq)))
-                low_tgt_freq = poly(dest_temp)
-                high_tgt_freq = dc[pos-1](dest_temp)
-                return (1 - t) * low_tgt_freq + t * high_tgt_freq
-        # Frequency below minimum, no correction
-        return freq
+        return self.calc_freqs([freq], self.cal_temp, dest_temp)[0]
 
     def get_temperature(self):
         return self.temp_sensor.get_temp()[0]
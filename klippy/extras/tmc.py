@@ -81,6 +81,29 @@ class FieldHelper:
                 for field_name, mask in reg_fields.items()}
 
 
+######################################################################
+# Register access helpers
+######################################################################
+
+# Read several registers (in a single transaction if supported)
+def read_registers(mcu_tmc, reg_names):
+    get_registers = getattr(mcu_tmc, 'get_registers', None)
+    if get_registers is not None:
+        return get_registers(reg_names)
+    return [mcu_tmc.get_register(reg_name) for reg_name in reg_names]
+
+# Write the current values of several registers
+def write_registers(mcu_tmc, reg_names, print_time=None):
+    set_registers = getattr(mcu_tmc, 'set_registers', None)
+    if set_registers is not None:
+        set_registers(reg_names, print_time)
+        return
+    registers = mcu_tmc.get_fields().registers
+    for reg_name in reg_names:
+        val = registers[reg_name] # Val may change during loop
+        mcu_tmc.set_register(reg_name, val, print_time)
+
+
 ######################################################################
 # Periodic error checking
 ######################################################################
@@ -128,21 +151,32 @@ class TMCErrorCheck:
         if self.adc_temp_reg is not None:
             pheaters = self.printer.load_object(config, 'heaters')
             pheaters.register_monitor(config)
-    def _query_register(self, reg_info, try_clear=False):
+    def _read_registers(self, reg_infos):
+        # Read the registers together (a failed read is retried later)
+        reg_names = [reg_info[1] for reg_info in reg_infos]
+        if not hasattr(self.mcu_tmc, 'get_registers'):
+            return [None] * len(reg_names)
+        try:
+            return self.mcu_tmc.get_registers(reg_names)
+        except self.printer.command_error:
+            return [None] * len(reg_names)
+    def _query_register(self, reg_info, try_clear=False, val=None):
         last_value, reg_name, mask, err_mask, cs_actual_mask = reg_info
         cleared_flags = 0
         count = 0
         while 1:
-            try:
-                val = self.mcu_tmc.get_register(reg_name)
-            except self.printer.command_error as e:
-                count += 1
-                if count < 3 and str(e).startswith("Unable to read tmc uart"):
-                    # Allow more retries on a TMC UART read error
-                    reactor = self.printer.get_reactor()
-                    reactor.pause(reactor.monotonic() + 0.050)
-                    continue
-                raise
+            if val is None:
+                try:
+                    val = self.mcu_tmc.get_register(reg_name)
+                except self.printer.command_error as e:
+                    count += 1
+                    if (count < 3
+                        and str(e).startswith("Unable to read tmc uart")):
+                        # Allow more retries on a TMC UART read error
+                        reactor = self.printer.get_reactor()
+                        reactor.pause(reactor.monotonic() + 0.050)
+                        continue
+                    raise
             if val & mask != last_value & mask:
                 fmt = self.fields.pretty_format(reg_name, val)
                 logging.info("TMC '%s' reports %s", self.stepper_name, fmt)
@@ -166,8 +200,12 @@ class TMCErrorCheck:
                 try_clear = False
                 cleared_flags |= val & err_mask
                 self.mcu_tmc.set_register(reg_name, val & err_mask)
+            val = None
         return cleared_flags
-    def _query_temperature(self):
+    def _query_temperature(self, val=None):
+        if val is not None:
+            self.adc_temp = val
+            return
         try:
             self.adc_temp = self.mcu_tmc.get_register(self.adc_temp_reg)
         except self.printer.command_error as e:
@@ -176,11 +214,17 @@ class TMCErrorCheck:
             return
     def _do_periodic_check(self, eventtime):
         try:
-            self._query_register(self.drv_status_reg_info)
+            reg_infos = [self.drv_status_reg_info]
             if self.gstat_reg_info is not None:
-                self._query_register(self.gstat_reg_info)
+                reg_infos.append(self.gstat_reg_info)
             if self.adc_temp_reg is not None:
-                self._query_temperature()
+                reg_infos.append([None, self.adc_temp_reg])
+            vals = self._read_registers(reg_infos)
+            self._query_register(self.drv_status_reg_info, val=vals[0])
+            if self.gstat_reg_info is not None:
+                self._query_register(self.gstat_reg_info, val=vals[1])
+            if self.adc_temp_reg is not None:
+                self._query_temperature(vals[-1])
         except self.printer.command_error as e:
             self.printer.invoke_shutdown(str(e))
             return self.printer.get_reactor().NEVER
@@ -194,10 +238,15 @@ class TMCErrorCheck:
         if self.check_timer is not None:
             self.stop_checks()
         cleared_flags = 0
-        self._query_register(self.drv_status_reg_info)
+        reg_infos = [self.drv_status_reg_info]
+        if self.gstat_reg_info is not None:
+            reg_infos.append(self.gstat_reg_info)
+        vals = self._read_registers(reg_infos)
+        self._query_register(self.drv_status_reg_info, val=vals[0])
         if self.gstat_reg_info is not None:
             cleared_flags = self._query_register(self.gstat_reg_info,
-                                                 try_clear=self.clear_gstat)
+                                                 try_clear=self.clear_gstat,
+                                                 val=vals[1])
         reactor = self.printer.get_reactor()
         curtime = reactor.monotonic()
         self.check_timer = reactor.register_timer(self._do_periodic_check,
@@ -262,9 +311,8 @@ class TMCCommandHelper:
                                    desc=self.cmd_SET_TMC_CURRENT_help)
     def _init_registers(self, print_time=None):
         # Send registers
-        for reg_name in list(self.fields.registers.keys()):
-            val = self.fields.registers[reg_name] # Val may change during loop
-            self.mcu_tmc.set_register(reg_name, val, print_time)
+        write_registers(self.mcu_tmc, list(self.fields.registers.keys()),
+                        print_time)
     cmd_INIT_TMC_help = "Initialize TMC stepper driver registers"
     def cmd_INIT_TMC(self, gcmd):
         logging.info("INIT_TMC %s", self.name)
@@ -450,8 +498,8 @@ class TMCCommandHelper:
                 if reg_name not in self.read_registers:
                     gcmd.respond_info(self.fields.pretty_format(reg_name, val))
             gcmd.respond_info("========== Queried registers ==========")
-            for reg_name in self.read_registers:
-                val = self.mcu_tmc.get_register(reg_name)
+            vals = read_registers(self.mcu_tmc, self.read_registers)
+            for reg_name, val in zip(self.read_registers, vals):
                 if self.read_translate is not None:
                     reg_name, val = self.read_translate(reg_name, val)
                 gcmd.respond_info(self.fields.pretty_format(reg_name, val))
@@ -88,7 +88,8 @@ class MCU_TMC_uart_bitbang:
             self.analog_mux = MCU_analog_mux(self.mcu, self.cmd_queue,
                                              select_pins_desc)
         self.instances = {}
-        self.tmcuart_send_cmd = None
+        self.tmcuart_send_cmd = self.tmcuart_batch_cmd = None
+        self.batch_size = 0
         self.mcu.register_config_callback(self.build_config)
     def build_config(self):
         baud = TMC_BAUD_RATE
@@ -103,6 +104,12 @@ class MCU_TMC_uart_bitbang:
             "tmcuart_send oid=%c write=%*s read=%c",
             "tmcuart_response oid=%c read=%*s", oid=self.oid,
             cq=self.cmd_queue, is_async=True)
+        self.batch_size = self.mcu.get_constants().get("TMCUART_BATCH_SIZE", 0)
+        if self.batch_size:
+            self.tmcuart_batch_cmd = self.mcu.lookup_query_command(
+                "tmcuart_send_batch oid=%c write=%*s",
+                "tmcuart_batch_response oid=%c read=%*s", oid=self.oid,
+                cq=self.cmd_queue, is_async=True)
     def register_instance(self, rx_pin_params, tx_pin_params,
                           select_pins_desc, addr):
         if (rx_pin_params['pin'] != self.rx_pin
@@ -184,6 +191,48 @@ class MCU_TMC_uart_bitbang:
             self.analog_mux.activate(instance_id)
         msg = self._encode_write(0xf5, addr, reg | 0x80, val)
         self.tmcuart_send_cmd.send([self.oid, msg, 0], minclock=minclock)
+    def reg_batch(self, instance_id, addr, ops, print_time=None):
+        # Perform several register reads and writes (ops is a list of
+        # (reg, val) with a val of None for reads).  Returns the values
+        # read (None if a read failed).
+        if self.tmcuart_batch_cmd is None:
+            res = []
+            for reg, val in ops:
+                if val is None:
+                    res.append(self.reg_read(instance_id, addr, reg))
+                else:
+                    self.reg_write(instance_id, addr, reg, val, print_time)
+            return res
+        minclock = 0
+        if print_time is not None:
+            minclock = self.mcu.print_time_to_clock(print_time)
+        if self.analog_mux is not None:
+            self.analog_mux.activate(instance_id)
+        # Group the messages into batches that fit in the mcu buffers
+        batches = []
+        data = read_regs = None
+        for reg, val in ops:
+            if val is None:
+                msg = self._encode_read(0xf5, addr, reg)
+                read_len = 10
+            else:
+                msg = self._encode_write(0xf5, addr, reg | 0x80, val)
+                read_len = 0
+            if (data is None or len(data) + 2 + len(msg) > self.batch_size
+                or len(read_regs) * 10 + read_len > self.batch_size):
+                data, read_regs = bytearray(), []
+                batches.append((data, read_regs))
+            data.extend(bytearray([len(msg), read_len]) + msg)
+            if read_len:
+                read_regs.append(reg)
+        res = []
+        for data, read_regs in batches:
+            params = self.tmcuart_batch_cmd.send([self.oid, data],
+                                                 minclock=minclock)
+            read = params['read']
+            res.extend([self._decode_read(reg, read[i*10:(i+1)*10])
+                        for i, reg in enumerate(read_regs)])
+        return res
 
 # Lookup a (possibly shared) tmc uart
 def lookup_tmc_uart_bitbang(config, max_addr):
@@ -235,6 +284,16 @@ class MCU_TMC_uart:
     def get_register(self, reg_name):
         with self.mutex:
             return self._do_get_register(reg_name)
+    def get_registers(self, reg_names):
+        # Read several registers in a single batch
+        if self.printer.get_start_args().get('debugoutput') is not None:
+            return [0] * len(reg_names)
+        with self.mutex:
+            ops = [(self.name_to_reg[reg_name], None) for reg_name in reg_names]
+            vals = self.mcu_uart.reg_batch(self.instance_id, self.addr, ops)
+            # Retry any failed reads individually
+            return [val if val is not None else self._do_get_register(name)
+                    for name, val in zip(reg_names, vals)]
     def set_register(self, reg_name, val, print_time=None):
         reg = self.name_to_reg[reg_name]
         if self.printer.get_start_args().get('debugoutput') is not None:
@@ -251,5 +310,26 @@ class MCU_TMC_uart:
                     return
         raise self.printer.command_error(
             "Unable to write tmc uart '%s' register %s" % (self.name, reg_name))
+    def set_registers(self, reg_names, print_time=None):
+        # Write the current values of several registers in a single
+        # batch (verified by the change in the IFCNT register)
+        if self.printer.get_start_args().get('debugoutput') is not None:
+            return
+        with self.mutex:
+            ifcnt = self.ifcnt
+            if ifcnt is None:
+                self.ifcnt = ifcnt = self._do_get_register("IFCNT")
+            ops = [(self.name_to_reg[reg_name], self.fields.registers[reg_name])
+                   for reg_name in reg_names]
+            ops.append((self.name_to_reg["IFCNT"], None))
+            self.ifcnt = self.mcu_uart.reg_batch(
+                self.instance_id, self.addr, ops, print_time)[-1]
+            if self.ifcnt == (ifcnt + len(reg_names)) & 0xff:
+                return
+            self.ifcnt = None
+        # Fall back to writing and verifying each register
+        for reg_name in reg_names:
+            self.set_register(reg_name, self.fields.registers[reg_name],
+                              print_time)
     def get_tmc_frequency(self):
         return self.tmc_frequency
@@ -0,0 +1,256 @@
+# Continuous toolhead vibration monitoring using an accelerometer
+#
+# Copyright (C) 2026  pulponair <pulponair@users.noreply.github.com>
+#
+# This file may be distributed under the terms of the GNU GPLv3 license.
+import logging, math, importlib
+
+AXES = ('x', 'y', 'z')
+MAX_SAMPLE_GAP = 3.
+
+# Rolling spectrum of accelerometer measurements.  Each window of
+# samples (overlapping by half a window) is transformed with a Hann
+# window and the power spectral density of each axis is exponentially
+# smoothed over time.
+class SpectrumTracker:
+    def __init__(self, window_time, smooth_time, bands):
+        self.numpy = None
+        self.window_time = window_time
+        self.smooth_time = smooth_time
+        self.bands = bands
+        self.reset()
+    def set_numpy(self, numpy):
+        self.numpy = numpy
+    def reset(self):
+        self.sample_rate = 0.
+        self.nfft = 0
+        self.pending = []
+        self.pending_count = 0
+        self.last_time = None
+        self.psd = None
+        self.freqs = None
+    def _setup(self, sample_rate):
+        np = self.numpy
+        self.sample_rate = sample_rate
+        self.nfft = nfft = 1 << int(
+            sample_rate * self.window_time - 1).bit_length()
+        self.window = window = np.hanning(nfft)
+        # Scale to a one-sided power spectral density
+        self.scale = 2. / (sample_rate * np.sum(window**2))
+        self.freqs = np.fft.rfftfreq(nfft, 1. / sample_rate)
+        self.bin_width = sample_rate / nfft
+        self.band_masks = [(self.freqs >= low) & (self.freqs < high)
+                           for low, high in self.bands]
+        self.peak_mask = ((self.freqs >= self.bands[0][0])
+                          & (self.freqs < self.bands[-1][1]))
+        self.alpha = 1. - math.exp(-.5 * nfft / (sample_rate
+                                                 * self.smooth_time))
+    def add_samples(self, samples):
+        # Returns True if the spectrum was updated
+        np = self.numpy
+        data = np.array(samples, dtype=float)
+        if len(data) < 2:
+            return False
+        times = data[:,0]
+        sample_rate = (len(data) - 1) / (times[-1] - times[0])
+        if (self.last_time is not None
+                and times[0] - self.last_time > MAX_SAMPLE_GAP / sample_rate):
+            # Lost samples (or the chip was restarted)
+            self.pending = []
+            self.pending_count = 0
+        if abs(sample_rate - self.sample_rate) > .1 * sample_rate:
+            # Query rate changed - start over
+            self.reset()
+            self._setup(sample_rate)
+        self.last_time = times[-1]
+        self.pending.append(data[:,1:])
+        self.pending_count += len(data)
+        nfft = self.nfft
+        if self.pending_count < nfft:
+            return False
+        accels = np.concatenate(self.pending)
+        updated = False
+        hop = nfft // 2
+        while len(accels) >= nfft:
+            self._process_window(accels[:nfft])
+            accels = accels[hop:]
+            updated = True
+        self.pending = [accels]
+        self.pending_count = len(accels)
+        return updated
+    def _process_window(self, accels):
+        np = self.numpy
+        accels = accels - np.mean(accels, axis=0)
+        fft = np.fft.rfft(accels * self.window[:,np.newaxis], axis=0)
+        psd = (fft.real**2 + fft.imag**2) * self.scale
+        if self.psd is None:
+            self.psd = psd
+        else:
+            self.psd += self.alpha * (psd - self.psd)
+    def get_axis_stats(self):
+        np = self.numpy
+        psd = self.psd
+        res = {}
+        for i, axis in enumerate(AXES):
+            axis_psd = psd[:,i]
+            band_energy = [float(np.sum(axis_psd[mask]) * self.bin_width)
+                           for mask in self.band_masks]
+            peak_psd = np.where(self.peak_mask, axis_psd, 0.)
+            res[axis] = {
+                'rms': math.sqrt(sum(band_energy)),
+                'peak_frequency': float(self.freqs[np.argmax(peak_psd)]),
+                'band_rms': [math.sqrt(e) for e in band_energy],
+            }
+        return res
+    def get_spectrum(self):
+        if self.psd is None:
+            return {}
+        return {'freqs': self.freqs.tolist(),
+                'psd_x': self.psd[:,0].tolist(),
+                'psd_y': self.psd[:,1].tolist(),
+                'psd_z': self.psd[:,2].tolist()}
+
+class VibrationMonitor:
+    def __init__(self, config):
+        self.printer = config.get_printer()
+        self.chip_name = config.get('accel_chip').strip()
+        self.rate = config.getchoice('rate', [200, 400, 800, 1600], 400)
+        window_time = config.getfloat('window_time', 0.5, minval=0.05)
+        smooth_time = config.getfloat('smooth_time', 5., above=0.)
+        self.bands = bands = []
+        for band in config.getlists('bands', ((5., 40.), (40., 80.),
+                                              (80., 150.)),
+                                    seps=('-', ','), count=2,
+                                    parser=float):
+            low, high = band
+            if low < 0. or high <= low or (bands and low < bands[-1][1]):
+                raise config.error("Invalid bands '%s' in section '%s'"
+                                   % (config.get('bands'),
+                                      config.get_name()))
+            bands.append((low, high))
+        if bands[-1][1] > .5 * self.rate:
+            raise config.error("Bands in section '%s' must be below %.1f Hz"
+                               % (config.get_name(), .5 * self.rate))
+        self.auto_start = config.getboolean('auto_start', False)
+        self.tracker = SpectrumTracker(window_time, smooth_time, bands)
+        self.chip = None
+        self.is_enabled = False
+        self.session = 0
+        self.overflows = 0
+        self.status = self._build_status()
+        # Status change reporting (for webhooks subscriptions)
+        webhooks = self.printer.lookup_object('webhooks')
+        self.note_status_change = webhooks.register_status_notifier(
+            'vibration_monitor', ['enabled', 'sample_rate', 'overflows',
+                                  'x', 'y', 'z']).note_change
+        webhooks.register_endpoint("vibration_monitor/query",
+                                   self._handle_query_request)
+        self.printer.register_event_handler("klippy:connect",
+                                            self._handle_connect)
+        self.printer.register_event_handler("klippy:ready",
+                                            self._handle_ready)
+        self.printer.register_event_handler("klippy:shutdown",
+                                            self._handle_shutdown)
+        gcode = self.printer.lookup_object('gcode')
+        gcode.register_command("VIBRATION_MONITOR",
+                               self.cmd_VIBRATION_MONITOR,
+                               desc=self.cmd_VIBRATION_MONITOR_help)
+    def _handle_connect(self):
+        self.chip = self.printer.lookup_object(self.chip_name)
+    def _handle_ready(self):
+        if not self.auto_start:
+            return
+        try:
+            self._start()
+        except self.printer.command_error:
+            logging.exception("Unable to start vibration monitoring")
+    def _handle_shutdown(self):
+        self.is_enabled = False
+    # Measurement handling
+    def _start(self):
+        if self.is_enabled:
+            return
+        if self.tracker.numpy is None:
+            # numpy is only needed once measurements start
+            try:
+                self.tracker.set_numpy(importlib.import_module('numpy'))
+            except ImportError:
+                raise self.printer.command_error(
+                    "Vibration monitoring requires the numpy module")
+        self.tracker.reset()
+        self.overflows = 0
+        self.status = self._build_status()
+        self.is_enabled = True
+        # A previous client may still be registered with the chip
+        self.session += 1
+        session = self.session
+        batch_cb = (lambda msg: self._handle_batch(session, msg))
+        start_monitor_client = getattr(self.chip, 'start_monitor_client',
+                                       None)
+        try:
+            if start_monitor_client is not None:
+                start_monitor_client(batch_cb, self.rate)
+            else:
+                # Chip has no reduced rate mode - use its configured rate
+                self.chip.batch_bulk.add_client(batch_cb)
+        except self.printer.command_error:
+            self.is_enabled = False
+            raise
+        self.note_status_change(('enabled',))
+    def _stop(self):
+        # The client is unregistered on its next batch
+        self.is_enabled = False
+        self.note_status_change(('enabled',))
+    def _handle_batch(self, session, msg):
+        if not self.is_enabled or session != self.session:
+            return False
+        self.overflows = msg.get('overflows', self.overflows)
+        if self.tracker.add_samples(msg['data']):
+            self.status = self._build_status()
+            self.note_status_change(('sample_rate', 'overflows') + AXES)
+        return True
+    def _build_status(self):
+        tracker = self.tracker
+        status = {'enabled': self.is_enabled,
+                  'sample_rate': round(tracker.sample_rate, 1),
+                  'overflows': self.overflows,
+                  'bands': [list(b) for b in self.bands]}
+        if tracker.psd is not None:
+            status.update(tracker.get_axis_stats())
+        else:
+            for axis in AXES:
+                status[axis] = {'rms': 0., 'peak_frequency': 0.,
+                                'band_rms': [0.] * len(self.bands)}
+        return status
+    def get_status(self, eventtime):
+        status = dict(self.status)
+        status['enabled'] = self.is_enabled
+        return status
+    # Webhooks and G-Code commands
+    def _handle_query_request(self, web_request):
+        eventtime = self.printer.get_reactor().monotonic()
+        result = self.get_status(eventtime)
+        result['spectrum'] = self.tracker.get_spectrum()
+        web_request.send(result)
+    cmd_VIBRATION_MONITOR_help = "Enable or disable vibration monitoring"
+    def cmd_VIBRATION_MONITOR(self, gcmd):
+        enable = gcmd.get_int('ENABLE', None, minval=0, maxval=1)
+        if enable:
+            self._start()
+        elif enable is not None:
+            self._stop()
+        status = self.status
+        if not self.is_enabled:
+            gcmd.respond_info("Vibration monitoring is disabled")
+            return
+        msg = ["Vibration monitoring at %.0f Hz (overflows: %d)"
+               % (status['sample_rate'], status['overflows'])]
+        for axis in AXES:
+            st = status[axis]
+            msg.append("%s: rms=%.1f peak=%.1f Hz bands=%s" % (
+                axis, st['rms'], st['peak_frequency'],
+                ",".join(["%.1f" % (b,) for b in st['band_rms']])))
+        gcmd.respond_info("\n".join(msg))
+
+def load_config(config):
+    return VibrationMonitor(config)
@@ -3,9 +3,100 @@
 # Copyright (C) 2018-2024  Kevin O'Connor <kevin@koconnor.net>
 #
 # This file may be distributed under the terms of the GNU GPLv3 license.
-import os, sys, logging, io
+import os, sys, logging, io, struct
 
-VALID_GCODE_EXTS = ['gcode', 'g', 'gco']
+VALID_GCODE_EXTS = ['gcode', 'g', 'gco', 'kgc']
+
+
+######################################################################
+# Compact binary g-code format
+######################################################################
+
+# A binary file starts with BINARY_MAGIC followed by a series of
+# records.  Each record starts with a tag byte.  A move record has the
+# BINARY_MOVE bit set, BINARY_G0 set for G0 moves, and the low five
+# bits indicating which of the X, Y, Z, E, F parameters follow (each
+# as a little-endian int32 holding the value multiplied by its
+# scale).  A BINARY_TEXT record is followed by a little-endian uint32
+# length and that many bytes of utf-8 encoded g-code text.  Decoded
+# moves are dispatched with numeric parameters (see ParsedGCodeCommand).
+BINARY_MAGIC = b"KGCB\x01\n"
+BINARY_TEXT = 0x01
+BINARY_MOVE = 0x80
+BINARY_G0 = 0x40
+BINARY_PARAMS = "XYZEF"
+BINARY_SCALES = (10000, 10000, 10000, 100000, 1000)
+
+def _build_move_formats():
+    formats = []
+    for mask in range(1 << len(BINARY_PARAMS)):
+        fields = [(BINARY_PARAMS[i], float(BINARY_SCALES[i]))
+                  for i in range(len(BINARY_PARAMS)) if mask & (1 << i)]
+        formats.append((struct.Struct("<" + "i" * len(fields)), fields))
+    return formats
+BINARY_MOVE_FORMATS = _build_move_formats()
+BINARY_TEXT_FORMAT = struct.Struct("<I")
+
+def encode_binary_move(cmd, values):
+    # values is a dict of param name to integer (value * scale)
+    mask = 0
+    ivals = []
+    for i, name in enumerate(BINARY_PARAMS):
+        if name in values:
+            mask |= 1 << i
+            ivals.append(values[name])
+    tag = BINARY_MOVE | mask
+    if cmd == 'G0':
+        tag |= BINARY_G0
+    return (bytearray([tag])
+            + BINARY_MOVE_FORMATS[mask][0].pack(*ivals))
+
+def encode_binary_text(line):
+    data = line.encode('utf-8')
+    return (bytearray([BINARY_TEXT])
+            + BINARY_TEXT_FORMAT.pack(len(data)) + data)
+
+def decode_binary_records(data):
+    # Returns a list of (record_size, item) and the unparsed remainder.
+    # The item is a text line or a (command, values) tuple for a move,
+    # where values holds the move's parameters as numbers.
+    data = bytearray(data)
+    records = []
+    pos = 0
+    datalen = len(data)
+    text_size = BINARY_TEXT_FORMAT.size
+    while pos < datalen:
+        tag = data[pos]
+        if tag & BINARY_MOVE:
+            fmt, fields = BINARY_MOVE_FORMATS[tag & 0x1f]
+            end = pos + 1 + fmt.size
+            if end > datalen:
+                break
+            gnum = 0 if tag & BINARY_G0 else 1
+            cmd = 'G%d' % (gnum,)
+            values = {'G': gnum}
+            for (name, scale), ival in zip(fields,
+                                           fmt.unpack_from(data, pos + 1)):
+                values[name] = ival / scale
+            records.append((end - pos, (cmd, values)))
+        elif tag == BINARY_TEXT:
+            if pos + 1 + text_size > datalen:
+                break
+            end = (pos + 1 + text_size
+                   + BINARY_TEXT_FORMAT.unpack_from(data, pos + 1)[0])
+            if end > datalen:
+                break
+            line = data[pos + 1 + text_size:end].decode('utf-8')
+            records.append((end - pos, line))
+        else:
+            raise ValueError("Invalid binary g-code record tag %d" % (tag,))
+        pos = end
+    return records, data[pos:]
+
+
+######################################################################
+# Virtual sdcard
+######################################################################
 
 DEFAULT_ERROR_GCODE = """
 {% if 'heaters' in printer %}
@@ -22,6 +113,7 @@ class VirtualSD:
         sd = config.get('path')
         self.sdcard_dirname = os.path.normpath(os.path.expanduser(sd))
         self.current_file = None
+        self.is_binary_file = False
         self.file_position = self.file_size = 0
         # Print Stat Tracking
         self.print_stats = self.printer.load_object(config, 'print_stats')
@@ -183,7 +275,11 @@ class VirtualSD:
             if fname not in flist:
                 fname = files_by_lower[fname.lower()]
             fname = os.path.join(self.sdcard_dirname, fname)
-            f = io.open(fname, 'r', newline='')
+            f = io.open(fname, 'rb')
+            is_binary = f.read(len(BINARY_MAGIC)) == BINARY_MAGIC
+            if not is_binary:
+                f.close()
+                f = io.open(fname, 'r', newline='')
             f.seek(0, os.SEEK_END)
             fsize = f.tell()
             f.seek(0)
@@ -193,6 +289,7 @@ class VirtualSD:
         gcmd.respond_raw("File opened:%s Size:%d" % (filename, fsize))
         gcmd.respond_raw("File selected")
         self.current_file = f
+        self.is_binary_file = is_binary
         self.file_position = 0
         self.file_size = fsize
         self.print_stats.set_current_file(filename)
@@ -228,6 +325,9 @@ class VirtualSD:
     def work_handler(self, eventtime):
         logging.info("Starting SD card print (position %d)", self.file_position)
         self.reactor.unregister_timer(self.work_timer)
+        is_binary = self.is_binary_file
+        if is_binary:
+            self.file_position = max(self.file_position, len(BINARY_MAGIC))
         try:
             self.current_file.seek(self.file_position)
         except:
@@ -236,7 +336,7 @@ class VirtualSD:
             return self.reactor.NEVER
         self.print_stats.note_start()
         gcode_mutex = self.gcode.get_mutex()
-        partial_input = ""
+        partial_input = b"" if is_binary else ""
         lines = []
         error_message = None
         while not self.must_pause_work:
@@ -249,15 +349,26 @@ class VirtualSD:
                     break
                 if not data:
                     # End of file
+                    if is_binary and partial_input:
+                        logging.warning("virtual_sdcard truncated record")
                     self.current_file.close()
                     self.current_file = None
                     logging.info("Finished SD card print")
                     self.gcode.respond_raw("Done printing file")
                     self.file_position = self.file_size
                     break
-                lines = data.split('\n')
-                lines[0] = partial_input + lines[0]
-                partial_input = lines.pop()
+                if is_binary:
+                    try:
+                        lines, partial_input = decode_binary_records(
+                            partial_input + data)
+                    except ValueError:
+                        logging.exception("virtual_sdcard binary decode")
+                        error_message = "Invalid binary g-code file"
+                        break
+                else:
+                    lines = data.split('\n')
+                    lines[0] = partial_input + lines[0]
+                    partial_input = lines.pop()
                 lines.reverse()
                 self.reactor.pause(self.reactor.NOW)
                 continue
@@ -268,13 +379,19 @@ class VirtualSD:
             # Dispatch command
             self.cmd_from_sd = True
             line = lines.pop()
-            if sys.version_info.major >= 3:
+            if is_binary:
+                record_size, line = line
+                next_file_position = self.file_position + record_size
+            elif sys.version_info.major >= 3:
                 next_file_position = self.file_position + len(line.encode()) + 1
             else:
                 next_file_position = self.file_position + len(line) + 1
             self.next_file_position = next_file_position
             try:
-                self.gcode.run_script(line)
+                if type(line) is tuple:
+                    self.gcode.run_parsed_command(*line)
+                else:
+                    self.gcode.run_script(line)
             except self.gcode.error as e:
                 error_message = str(e)
                 try:
@@ -296,7 +413,7 @@ class VirtualSD:
                     self.work_timer = None
                     return self.reactor.NEVER
                 lines = []
-                partial_input = ""
+                partial_input = b"" if is_binary else ""
         logging.info("Exiting SD card print (position %d)", self.file_position)
         self.work_timer = None
         self.cmd_from_sd = False
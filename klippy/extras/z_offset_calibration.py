@@ -54,12 +54,9 @@ class ZoffsetCalibration:
         extruder_temp = gcmd.get_float('EXTRUDER_TEMP', default=130.0)
         # Heat up
         pheaters = self.printer.lookup_object('heaters')
-        ## set temp
+        ## set temp (homing and travel run while the heaters ramp up)
         pheaters.set_temperature(pheater_bed.heater, bed_temp, wait=False)
         pheaters.set_temperature(pheater_extruder.heater, extruder_temp, wait=False)
-        ## wait for heating
-        pheaters.set_temperature(pheater_bed.heater, bed_temp, wait=True)
-        pheaters.set_temperature(pheater_extruder.heater, extruder_temp, wait=True)
         # Home xy
         curtime = self.printer.get_reactor().monotonic()
         if 'xy' not in self.toolhead.get_status(curtime)['homed_axes']:
@@ -73,6 +70,9 @@ class ZoffsetCalibration:
         # Move to probe position
         gcmd.respond_info("ZoffsetCalibration: Toolhead move ...")
         self.toolhead.manual_move([self.endstop_x_pos, self.endstop_y_pos], self.speed)
+        ## wait for heating (only contact probing needs the targets)
+        gcmd.respond_info("ZoffsetCalibration: Waiting for heaters ...")
+        pheaters.wait_for_heaters([pheater_bed.heater, pheater_extruder.heater])
         # Contact probe calibration
         gcmd.respond_info("ZoffsetCalibration: Toolhead probing ...")
         zendstop_p = _contact_probe.run_contact_probe(gcmd)
@@ -26,11 +26,15 @@ class GCodeCommand:
         return self._commandline
     def get_command_parameters(self):
         return self._params
+    def get_command_values(self):
+        # Parameters that may already be parsed to numbers (callers must
+        # still convert them with float() or int())
+        return self._params
     def get_raw_command_parameters(self):
         command = self._command
         if command.startswith("M117 ") or command.startswith("M118 "):
             command = command[:4]
-        rawparams = self._commandline
+        rawparams = self.get_commandline()
         urawparams = rawparams.upper()
         if not urawparams.startswith(command):
             rawparams = rawparams[urawparams.find(command):]
@@ -58,25 +62,25 @@ class GCodeCommand:
         if value is None:
             if default is self.sentinel:
                 raise self.error("Error on '%s': missing %s"
-                                 % (self._commandline, name))
+                                 % (self.get_commandline(), name))
             return default
         try:
             value = parser(value)
         except:
             raise self.error("Error on '%s': unable to parse %s"
-                             % (self._commandline, value))
+                             % (self.get_commandline(), value))
         if minval is not None and value < minval:
             raise self.error("Error on '%s': %s must have minimum of %s"
-                             % (self._commandline, name, minval))
+                             % (self.get_commandline(), name, minval))
         if maxval is not None and value > maxval:
             raise self.error("Error on '%s': %s must have maximum of %s"
-                             % (self._commandline, name, maxval))
+                             % (self.get_commandline(), name, maxval))
         if above is not None and value <= above:
             raise self.error("Error on '%s': %s must be above %s"
-                             % (self._commandline, name, above))
+                             % (self.get_commandline(), name, above))
         if below is not None and value >= below:
             raise self.error("Error on '%s': %s must be below %s"
-                             % (self._commandline, name, below))
+                             % (self.get_commandline(), name, below))
         return value
     def get_int(self, name, default=sentinel, minval=None, maxval=None):
         return self.get(name, default, parser=int, minval=minval, maxval=maxval)
@@ -85,6 +89,30 @@ class GCodeCommand:
         return self.get(name, default, parser=float, minval=minval,
                         maxval=maxval, above=above, below=below)
 
+# Command created from already parsed numeric parameters (the text
+# parameters and the command line are only generated if requested)
+class ParsedGCodeCommand(GCodeCommand):
+    def __init__(self, gcode, command, values):
+        GCodeCommand.__init__(self, gcode, command, None, None, False)
+        self._values = values
+    def get_command_values(self):
+        return self._values
+    def get_command_parameters(self):
+        if self._params is None:
+            self._params = {k: str(v) for k, v in self._values.items()}
+        return self._params
+    def get_commandline(self):
+        if self._commandline is None:
+            cmd = self._command
+            args = ["%s%s" % (k, v)
+                    for k, v in self.get_command_parameters().items()
+                    if k != cmd[0]]
+            self._commandline = " ".join([cmd] + args)
+        return self._commandline
+    def get(self, name, *args, **kwargs):
+        self.get_command_parameters()
+        return GCodeCommand.get(self, name, *args, **kwargs)
+
 # Parse and dispatch G-Code commands
 class GCodeDispatch:
     error = CommandError
@@ -205,23 +233,31 @@ class GCodeDispatch:
             params = { parts[i]: parts[i+1].strip()
                        for i in range(1, numparts, 2) }
             gcmd = GCodeCommand(self, cmd, origline, params, need_ack)
-            # Invoke handler for command
-            handler = self.gcode_handlers.get(cmd, self.cmd_default)
-            try:
-                handler(gcmd)
-            except self.error as e:
-                self._respond_error(str(e))
-                self.printer.send_event("gcode:command_error")
-                if not need_ack:
-                    raise
-            except:
-                msg = 'Internal error on command:"%s"' % (cmd,)
-                logging.exception(msg)
-                self.printer.invoke_shutdown(msg)
-                self._respond_error(msg)
-                if not need_ack:
-                    raise
-            gcmd.ack()
+            self._dispatch_command(gcmd, need_ack)
+    def _dispatch_command(self, gcmd, need_ack):
+        # Invoke handler for command
+        cmd = gcmd.get_command()
+        handler = self.gcode_handlers.get(cmd, self.cmd_default)
+        try:
+            handler(gcmd)
+        except self.error as e:
+            self._respond_error(str(e))
+            self.printer.send_event("gcode:command_error")
+            if not need_ack:
+                raise
+        except:
+            msg = 'Internal error on command:"%s"' % (cmd,)
+            logging.exception(msg)
+            self.printer.invoke_shutdown(msg)
+            self._respond_error(msg)
+            if not need_ack:
+                raise
+        gcmd.ack()
+    def run_parsed_command(self, command, values):
+        # Dispatch a command whose parameters are already parsed
+        gcmd = ParsedGCodeCommand(self, command, values)
+        with self.mutex:
+            self._dispatch_command(gcmd, False)
     def run_script_from_command(self, script):
         self._process_commands(script.split('\n'), need_ack=False)
     def run_script(self, script):
@@ -120,6 +120,7 @@ class MCU_trsync:
         self._stepper_stop_cmd = None
         self._trigger_completion = None
         self._home_end_clock = None
+        self._trigger_time = 0.
         mcu.register_config_callback(self._build_config)
         printer = mcu.get_printer()
         printer.register_event_handler("klippy:shutdown", self._shutdown)
@@ -192,6 +193,7 @@ class MCU_trsync:
               trigger_completion, expire_timeout):
         self._trigger_completion = trigger_completion
         self._home_end_clock = None
+        self._trigger_time = 0.
         clock = self._mcu.print_time_to_clock(print_time)
         expire_ticks = self._mcu.seconds_to_clock(expire_timeout)
         expire_clock = clock + expire_ticks
@@ -221,7 +223,13 @@ class MCU_trsync:
                                               self.REASON_HOST_REQUEST])
         for s in self._steppers:
             s.note_homing_end()
+        # Note when the trigger stopped the steppers on this mcu
+        if params['clock']:
+            clock = self._mcu.clock32_to_clock64(params['clock'])
+            self._trigger_time = self._mcu.clock_to_print_time(clock)
         return params['trigger_reason']
+    def get_trigger_time(self):
+        return self._trigger_time
 
 TRSYNC_TIMEOUT = 0.05
 TRSYNC_SINGLE_MCU_TIMEOUT = 0.250
@@ -233,6 +241,7 @@ class TriggerDispatch:
         ffi_main, ffi_lib = chelper.get_ffi()
         self._trdispatch = ffi_main.gc(ffi_lib.trdispatch_alloc(), ffi_lib.free)
         self._trsyncs = [MCU_trsync(mcu, self._trdispatch)]
+        self._trigger_latency = {}
     def get_oid(self):
         return self._trsyncs[0].get_oid()
     def get_command_queue(self):
@@ -255,6 +264,8 @@ class TriggerDispatch:
                                      " multi-mcu shared axis")
     def get_steppers(self):
         return [s for trsync in self._trsyncs for s in trsync.get_steppers()]
+    def get_trigger_latency(self):
+        return dict(self._trigger_latency)
     def start(self, print_time):
         reactor = self._mcu.get_printer().get_reactor()
         self._trigger_completion = reactor.completion()
@@ -279,6 +290,13 @@ class TriggerDispatch:
         ffi_main, ffi_lib = chelper.get_ffi()
         ffi_lib.trdispatch_stop(self._trdispatch)
         res = [trsync.stop() for trsync in self._trsyncs]
+        # Find the delay from the first trigger to the stop on each mcu
+        trigger_times = {trsync.get_mcu().get_name(): trsync.get_trigger_time()
+                         for trsync in self._trsyncs
+                         if trsync.get_trigger_time()}
+        first_time = min(trigger_times.values() or [0.])
+        self._trigger_latency = {name: tt - first_time
+                                 for name, tt in trigger_times.items()}
         err_res = [r for r in res if r >= MCU_trsync.REASON_COMMS_TIMEOUT]
         if err_res:
             return err_res[0]
@@ -292,8 +310,10 @@ class MCU_endstop:
         self._invert = pin_params['invert']
         self._oid = self._mcu.create_oid()
         self._home_cmd = self._query_cmd = None
+        self._tap_cmd = self._query_taps_cmd = None
         self._mcu.register_config_callback(self._build_config)
         self._rest_ticks = 0
+        self._tap_count = self._max_taps = 0
         self._dispatch = TriggerDispatch(mcu)
     def get_mcu(self):
         return self._mcu
@@ -301,6 +321,8 @@ class MCU_endstop:
         self._dispatch.add_stepper(stepper)
     def get_steppers(self):
         return self._dispatch.get_steppers()
+    def get_trigger_latency(self):
+        return self._dispatch.get_trigger_latency()
     def _build_config(self):
         # Setup config
         self._mcu.add_config_cmd("config_endstop oid=%d pin=%s pull_up=%d"
@@ -319,6 +341,16 @@ class MCU_endstop:
             "endstop_query_state oid=%c",
             "endstop_state oid=%c homing=%c next_clock=%u pin_value=%c",
             oid=self._oid, cq=cmd_queue)
+        self._max_taps = self._mcu.get_constants().get('ENDSTOP_MAX_TAPS', 0)
+        if self._max_taps:
+            self._tap_cmd = self._mcu.lookup_command(
+                "endstop_tap oid=%c clock=%u sample_ticks=%u sample_count=%c"
+                " rest_ticks=%u pin_value=%c hold_ticks=%u trsync_oid=%c"
+                " trigger_reason=%c", cq=cmd_queue)
+            self._query_taps_cmd = self._mcu.lookup_query_command(
+                "endstop_query_taps oid=%c",
+                "endstop_taps oid=%c count=%c clocks=%*s",
+                oid=self._oid, cq=cmd_queue)
     def home_start(self, print_time, sample_time, sample_count, rest_time,
                    triggered=True):
         clock = self._mcu.print_time_to_clock(print_time)
@@ -345,6 +377,42 @@ class MCU_endstop:
         params = self._query_cmd.send([self._oid])
         next_clock = self._mcu.clock32_to_clock64(params['next_clock'])
         return self._mcu.clock_to_print_time(next_clock - self._rest_ticks)
+    # Multi-tap probing (note each trigger without stopping the move)
+    def get_max_taps(self):
+        return self._max_taps
+    def tap_start(self, print_time, sample_time, sample_count, rest_time,
+                  tap_count, hold_time, triggered=True):
+        if tap_count > self._max_taps:
+            raise self._mcu.get_printer().command_error(
+                "Endstop does not support %d taps" % (tap_count,))
+        self._tap_count = tap_count
+        clock = self._mcu.print_time_to_clock(print_time)
+        rest_ticks = self._mcu.print_time_to_clock(print_time+rest_time) - clock
+        trigger_completion = self._dispatch.start(print_time)
+        self._tap_cmd.send(
+            [self._oid, clock, self._mcu.seconds_to_clock(sample_time),
+             sample_count, rest_ticks, triggered ^ self._invert,
+             self._mcu.seconds_to_clock(hold_time),
+             self._dispatch.get_oid(), MCU_trsync.REASON_ENDSTOP_HIT],
+            reqclock=clock)
+        return trigger_completion
+    def tap_wait(self, tap_end_time):
+        self._dispatch.wait_end(tap_end_time)
+        self._home_cmd.send([self._oid, 0, 0, 0, 0, 0, 0, 0])
+        res = self._dispatch.stop()
+        cmderr = self._mcu.get_printer().command_error
+        if res >= MCU_trsync.REASON_COMMS_TIMEOUT:
+            raise cmderr("Communication timeout during probing")
+        if self._mcu.is_fileoutput():
+            return [tap_end_time] * self._tap_count
+        if res == MCU_trsync.REASON_ENDSTOP_HIT:
+            raise cmderr("Endstop did not release during probing")
+        params = self._query_taps_cmd.send([self._oid])
+        data = bytearray(params['clocks'])
+        clocks = [data[i] | (data[i+1] << 8) | (data[i+2] << 16)
+                  | (data[i+3] << 24) for i in range(0, len(data), 4)]
+        return [self._mcu.clock_to_print_time(self._mcu.clock32_to_clock64(c))
+                for c in clocks]
     def query_endstop(self, print_time):
         clock = self._mcu.print_time_to_clock(print_time)
         if self._mcu.is_fileoutput():
@@ -608,9 +676,6 @@ class MCU:
         printer.load_object(config, "error_mcu")
         printer.register_event_handler("klippy:firmware_restart",
                                        self._firmware_restart)
-        printer.register_event_handler("klippy:mcu_identify",
-                                       self._mcu_identify)
-        printer.register_event_handler("klippy:connect", self._connect)
         printer.register_event_handler("klippy:shutdown", self._shutdown)
         printer.register_event_handler("klippy:disconnect", self._disconnect)
         printer.register_event_handler("klippy:ready", self._ready)
@@ -772,27 +837,32 @@ class MCU:
         logging.info(move_msg)
         log_info = self._log_info() + "\n" + move_msg
         self._printer.set_rollover_info(self._name, log_info, log=False)
-    def _mcu_identify(self):
+    def _connect_serial(self):
         if self.is_fileoutput():
             self._connect_file()
-        else:
-            resmeth = self._restart_method
-            if resmeth == 'rpi_usb' and not os.path.exists(self._serialport):
-                # Try toggling usb power
-                self._check_restart("enable power")
+            return
+        resmeth = self._restart_method
+        if resmeth == 'rpi_usb' and not os.path.exists(self._serialport):
+            # Try toggling usb power
+            self._check_restart("enable power")
+        try:
+            if self._canbus_iface is not None:
+                cbid = self._printer.lookup_object('canbus_ids')
+                nodeid = cbid.get_nodeid(self._serialport)
+                self._serial.connect_canbus(self._serialport, nodeid,
+                                            self._canbus_iface)
+            elif self._baud:
+                # Cheetah boards require RTS to be deasserted
+                # else a reset will trigger the built-in bootloader.
+                rts = (resmeth != "cheetah")
+                self._serial.connect_uart(self._serialport, self._baud, rts)
+            else:
+                self._serial.connect_pipe(self._serialport)
+        except serialhdl.error as e:
+            raise error(str(e))
+    def _mcu_identify(self):
+        if not self.is_fileoutput():
             try:
-                if self._canbus_iface is not None:
-                    cbid = self._printer.lookup_object('canbus_ids')
-                    nodeid = cbid.get_nodeid(self._serialport)
-                    self._serial.connect_canbus(self._serialport, nodeid,
-                                                self._canbus_iface)
-                elif self._baud:
-                    # Cheetah boards require RTS to be deasserted
-                    # else a reset will trigger the built-in bootloader.
-                    rts = (resmeth != "cheetah")
-                    self._serial.connect_uart(self._serialport, self._baud, rts)
-                else:
-                    self._serial.connect_pipe(self._serialport)
                 self._clocksync.connect(self._serial)
             except serialhdl.error as e:
                 raise error(str(e))
@@ -1012,14 +1082,54 @@ class MCU:
         self._get_status_info['last_stats'] = last_stats
         return False, '%s: %s' % (self._name, stats)
 
+######################################################################
+# MCU connection startup
+######################################################################
+
+# Connect to all mcus concurrently (each connection mostly waits on
+# its serial port, so there is no need to wait for them in turn)
+class PrinterMCUConnect:
+    def __init__(self, printer, mcus):
+        self._printer = printer
+        self._mcus = mcus
+        printer.register_event_handler("klippy:mcu_identify",
+                                       self._mcu_identify)
+        printer.register_event_handler("klippy:connect", self._connect)
+    def _run_concurrent(self, callbacks):
+        reactor = self._printer.get_reactor()
+        def wrap_callback(cb):
+            def run(eventtime):
+                try:
+                    cb()
+                except Exception as e:
+                    return e
+                return None
+            return run
+        completions = [reactor.register_callback(wrap_callback(cb))
+                       for cb in callbacks]
+        # Wait for all mcus before reporting the first error
+        errors = [completion.wait() for completion in completions]
+        for e in errors:
+            if e is not None:
+                raise e
+    def _mcu_identify(self):
+        # Open the connections and download the data dictionaries
+        self._run_concurrent([m._connect_serial for m in self._mcus])
+        # Synchronize the clocks (secondary mcus wait for the main mcu)
+        self._run_concurrent([m._mcu_identify for m in self._mcus])
+    def _connect(self):
+        self._run_concurrent([m._connect for m in self._mcus])
+
 def add_printer_objects(config):
     printer = config.get_printer()
     reactor = printer.get_reactor()
     mainsync = clocksync.ClockSync(reactor)
-    printer.add_object('mcu', MCU(config.getsection('mcu'), mainsync))
+    mcus = [MCU(config.getsection('mcu'), mainsync)]
+    printer.add_object('mcu', mcus[0])
     for s in config.get_prefix_sections('mcu '):
-        printer.add_object(s.section, MCU(
-            s, clocksync.SecondarySync(reactor, mainsync)))
+        mcus.append(MCU(s, clocksync.SecondarySync(reactor, mainsync)))
+        printer.add_object(s.section, mcus[-1])
+    PrinterMCUConnect(printer, mcus)
 
 def get_printer_mcu(printer, name):
     if name == 'mcu':
@@ -3,7 +3,7 @@
 # Copyright (C) 2016-2020  Kevin O'Connor <kevin@koconnor.net>
 #
 # This file may be distributed under the terms of the GNU GPLv3 license.
-import os, gc, select, math, time, logging, queue
+import os, gc, select, math, time, logging, queue, heapq
 import greenlet
 import chelper, util
 
@@ -14,6 +14,9 @@ class ReactorTimer:
     def __init__(self, callback, waketime):
         self.callback = callback
         self.waketime = waketime
+        # Current entry in the reactor timer heap (if any)
+        self.heap_entry = None
+        self.is_unregistered = False
 
 class ReactorCompletion:
     class sentinel: pass
@@ -101,8 +104,12 @@ class SelectReactor:
         # Python garbage collection
         self._check_gc = gc_checking
         self._last_gc_times = [0., 0., 0.]
-        # Timers
-        self._timers = []
+        # Timers - stored in a heap of (waketime, seq, timer) entries.
+        # Entries are invalidated (not removed) when a timer is updated.
+        self._timer_heap = []
+        self._timer_seq = 0
+        self._timer_deferred = []
+        self._timer_compact_size = 64
         self._next_timer = self.NEVER
         # Callbacks
         self._pipe_fds = None
@@ -117,21 +124,48 @@ class SelectReactor:
     def get_gc_stats(self):
         return tuple(self._last_gc_times)
     # Timers
-    def update_timer(self, timer_handler, waketime):
+    def _set_timer(self, timer_handler, waketime):
+        if timer_handler.is_unregistered:
+            return
         timer_handler.waketime = waketime
+        entry = timer_handler.heap_entry
+        if entry is not None and entry[0] == waketime:
+            return
+        if waketime >= self.NEVER:
+            timer_handler.heap_entry = None
+            return
+        heap = self._timer_heap
+        if len(heap) >= self._timer_compact_size:
+            # Discard invalidated entries
+            heap[:] = [e for e in heap if e[2].heap_entry is e]
+            heapq.heapify(heap)
+            self._timer_compact_size = max(64, 2 * len(heap))
+        self._timer_seq += 1
+        timer_handler.heap_entry = entry = (waketime, self._timer_seq,
+                                            timer_handler)
+        heapq.heappush(heap, entry)
         self._next_timer = min(self._next_timer, waketime)
+    def update_timer(self, timer_handler, waketime):
+        self._set_timer(timer_handler, waketime)
     def register_timer(self, callback, waketime=NEVER):
-        timer_handler = ReactorTimer(callback, waketime)
-        timers = list(self._timers)
-        timers.append(timer_handler)
-        self._timers = timers
-        self._next_timer = min(self._next_timer, waketime)
+        timer_handler = ReactorTimer(callback, self.NEVER)
+        self._set_timer(timer_handler, waketime)
         return timer_handler
     def unregister_timer(self, timer_handler):
         timer_handler.waketime = self.NEVER
-        timers = list(self._timers)
-        timers.pop(timers.index(timer_handler))
-        self._timers = timers
+        timer_handler.heap_entry = None
+        timer_handler.is_unregistered = True
+    def _restore_deferred_timers(self):
+        heap = self._timer_heap
+        deferred = self._timer_deferred
+        if deferred:
+            for entry in deferred:
+                if entry[2].heap_entry is entry:
+                    heapq.heappush(heap, entry)
+            del deferred[:]
+        while heap and heap[0][2].heap_entry is not heap[0]:
+            heapq.heappop(heap)
+        self._next_timer = heap[0][0] if heap else self.NEVER
     def _check_timers(self, eventtime, busy):
         if eventtime < self._next_timer:
             if busy:
@@ -149,18 +183,38 @@ class SelectReactor:
                     gc.collect(gc_level)
                     return 0.
             return min(1., max(.001, self._next_timer - eventtime))
-        self._next_timer = self.NEVER
+        # Run each timer that was due at the start of this pass (timers
+        # rescheduled during the pass are deferred to the next pass)
+        if self._timer_deferred:
+            self._restore_deferred_timers()
+        heap = self._timer_heap
+        deferred = self._timer_deferred
+        end_seq = self._timer_seq
         g_dispatch = self._g_dispatch
-        for t in self._timers:
-            waketime = t.waketime
-            if eventtime >= waketime:
-                t.waketime = self.NEVER
-                t.waketime = waketime = t.callback(eventtime)
-                if g_dispatch is not self._g_dispatch:
-                    self._next_timer = min(self._next_timer, waketime)
-                    self._end_greenlet(g_dispatch)
-                    return 0.
-            self._next_timer = min(self._next_timer, waketime)
+        while heap and heap[0][0] <= eventtime:
+            entry = heapq.heappop(heap)
+            t = entry[2]
+            if t.heap_entry is not entry:
+                continue
+            if entry[1] > end_seq:
+                deferred.append(entry)
+                continue
+            t.waketime = self.NEVER
+            t.heap_entry = None
+            waketime = t.callback(eventtime)
+            if waketime <= eventtime and not t.is_unregistered:
+                # Run again on the next pass
+                self._timer_seq += 1
+                t.heap_entry = entry = (waketime, self._timer_seq, t)
+                t.waketime = waketime
+                deferred.append(entry)
+            else:
+                self._set_timer(t, waketime)
+            if g_dispatch is not self._g_dispatch:
+                self._restore_deferred_timers()
+                self._end_greenlet(g_dispatch)
+                return 0.
+        self._restore_deferred_timers()
         return 0.
     # Callbacks and Completions
     def completion(self):
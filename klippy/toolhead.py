@@ -230,6 +230,12 @@ class ToolHead:
                                                 below=1., minval=0.)
         self.square_corner_velocity = config.getfloat(
             'square_corner_velocity', 5., minval=0.)
+        # Status change reporting (for webhooks subscriptions)
+        webhooks = self.printer.lookup_object('webhooks')
+        self.note_status_change = webhooks.register_status_notifier(
+            'toolhead', ['position', 'extruder', 'max_velocity', 'max_accel',
+                         'minimum_cruise_ratio', 'square_corner_velocity']
+        ).note_change
         self.junction_deviation = self.max_accel_to_decel = 0.
         self._calc_junction_deviation()
         # Input stall detection
@@ -259,6 +265,9 @@ class ToolHead:
         self.trapq_append = ffi_lib.trapq_append
         self.trapq_finalize_moves = ffi_lib.trapq_finalize_moves
         self.step_generators = []
+        # Stepper transform that alters the motion of the toolhead
+        # (eg, bed_mesh step compensation)
+        self.step_transform = None
         # Create kinematics class
         gcode = self.printer.lookup_object('gcode')
         self.Coord = gcode.Coord
@@ -453,12 +462,20 @@ class ToolHead:
     # Movement commands
     def get_position(self):
         return list(self.commanded_pos)
+    def calc_physical_position(self, pos):
+        # Convert a toolhead position to the actual nozzle position
+        if self.step_transform is None:
+            return list(pos)
+        return self.step_transform.calc_physical_position(pos)
+    def get_physical_position(self):
+        return self.calc_physical_position(self.commanded_pos)
     def set_position(self, newpos, homing_axes=()):
         self.flush_step_generation()
         ffi_main, ffi_lib = chelper.get_ffi()
         ffi_lib.trapq_set_position(self.trapq, self.print_time,
                                    newpos[0], newpos[1], newpos[2])
         self.commanded_pos[:] = newpos
+        self.note_status_change(('position',))
         self.kin.set_position(newpos, homing_axes)
         self.printer.send_event("toolhead:set_position")
     def move(self, newpos, speed):
@@ -467,9 +484,12 @@ class ToolHead:
             return
         if move.is_kinematic_move:
             self.kin.check_move(move)
+            if self.step_transform is not None:
+                self.step_transform.check_move(move)
         if move.axes_d[3]:
             self.extruder.check_move(move)
         self.commanded_pos[:] = move.end_pos
+        self.note_status_change(('position',))
         self.lookahead.add_move(move)
         if self.print_time > self.need_check_pause:
             self._check_pause()
@@ -495,6 +515,7 @@ class ToolHead:
     def set_extruder(self, extruder, extrude_pos):
         self.extruder = extruder
         self.commanded_pos[3] = extrude_pos
+        self.note_status_change(('extruder', 'position'))
     def get_extruder(self):
         return self.extruder
     # Homing "drip move" handling
@@ -515,6 +536,8 @@ class ToolHead:
                                              set_step_gen_time=True)
             self._advance_move_time(npt)
     def drip_move(self, newpos, speed, drip_completion):
+        self.drip_moves([(newpos, speed)], drip_completion)
+    def drip_moves(self, moves, drip_completion):
         self.dwell(self.kin_flush_delay)
         # Transition from "NeedPrime"/"Priming"/main state to "Drip" state
         self.lookahead.flush()
@@ -525,15 +548,16 @@ class ToolHead:
         self.lookahead.set_flush_time(BUFFER_TIME_HIGH)
         self.check_stall_time = 0.
         self.drip_completion = drip_completion
-        # Submit move
-        try:
-            self.move(newpos, speed)
-        except self.printer.command_error as e:
-            self.reactor.update_timer(self.flush_timer, self.reactor.NOW)
-            self.flush_step_generation()
-            raise
-        # Transmit move in "drip" mode
+        # Submit moves (a long sequence may start transmitting early)
         try:
+            try:
+                for newpos, speed in moves:
+                    self.move(newpos, speed)
+            except self.printer.command_error as e:
+                self.reactor.update_timer(self.flush_timer, self.reactor.NOW)
+                self.flush_step_generation()
+                raise
+            # Transmit move in "drip" mode
             self.lookahead.flush()
         except DripModeEndSignal as e:
             self.lookahead.reset()
@@ -566,7 +590,7 @@ class ToolHead:
                      'stalls': self.print_stall,
                      'estimated_print_time': estimated_print_time,
                      'extruder': self.extruder.get_name(),
-                     'position': self.Coord(*self.commanded_pos),
+                     'position': self.Coord(*self.get_physical_position()),
                      'max_velocity': self.max_velocity,
                      'max_accel': self.max_accel,
                      'minimum_cruise_ratio': self.min_cruise_ratio,
@@ -581,6 +605,10 @@ class ToolHead:
         return self.trapq
     def register_step_generator(self, handler):
         self.step_generators.append(handler)
+    def set_step_transform(self, step_transform):
+        self.flush_step_generation()
+        self.step_transform = step_transform
+        self.note_status_change(('position',))
     def note_step_generation_scan_time(self, delay, old_delay=0.):
         self.flush_step_generation()
         if old_delay:
@@ -608,6 +636,9 @@ class ToolHead:
         scv2 = self.square_corner_velocity**2
         self.junction_deviation = scv2 * (math.sqrt(2.) - 1.) / self.max_accel
         self.max_accel_to_decel = self.max_accel * (1. - self.min_cruise_ratio)
+        self.note_status_change(('max_velocity', 'max_accel',
+                                 'minimum_cruise_ratio',
+                                 'square_corner_velocity'))
     def cmd_G4(self, gcmd):
         # Dwell
         delay = gcmd.get_float('P', 0., minval=0.) / 1000.
@@ -3,10 +3,15 @@
 # Copyright (C) 2020 Eric Callahan <arksine.code@gmail.com>
 #
 # This file may be distributed under the terms of the GNU GPLv3 license
-import logging, socket, os, sys, errno, json, collections
+import logging, socket, os, sys, errno, json, collections, threading, struct
 import gcode
 import configparser
 
+try:
+    import msgpack
+except ImportError:
+    msgpack = None
+
 REQUEST_LOG_SIZE = 20
 
 # Json decodes strings as unicode types in Python 2.x.  This doesn't
@@ -27,6 +32,70 @@ if sys.version_info.major < 3:
                     for k, v in data.items()}
         return data
 
+# Message framing on the API socket.  The default framing is JSON
+# terminated by an ASCII 0x03 character.  A client may request the
+# more compact "msgpack" framing (messagepack data prefixed with a
+# 4-byte big-endian length) via the client_info of the "info" request.
+class JSONFraming:
+    name = "json"
+    def __init__(self):
+        self.encoder = json.JSONEncoder(separators=(',', ':'))
+    def split(self, data):
+        msgs = data.split(b'\x03')
+        partial = msgs.pop()
+        return msgs, partial
+    def decode(self, msg):
+        return json.loads(msg, object_hook=json_loads_byteify)
+    def encode_data(self, data):
+        return self.encoder.encode(data).encode()
+    def encode(self, data):
+        return self.encode_data(data) + b"\x03"
+    def encode_with_params(self, template, eparams):
+        # Build the encoding of template with a pre-encoded 'params'
+        tmp = self.encode_data(template)[:-1]
+        if template:
+            tmp += b','
+        return tmp + b'"params":' + eparams + b'}\x03'
+
+class MsgPackFraming:
+    name = "msgpack"
+    def __init__(self):
+        self.packer = msgpack.Packer(use_bin_type=True)
+    def split(self, data):
+        msgs = []
+        pos = 0
+        while pos + 4 <= len(data):
+            mlen = struct.unpack_from('>I', data, pos)[0]
+            if pos + 4 + mlen > len(data):
+                break
+            msgs.append(data[pos+4:pos+4+mlen])
+            pos += 4 + mlen
+        return msgs, data[pos:]
+    def decode(self, msg):
+        data = msgpack.unpackb(msg, raw=False)
+        if json_loads_byteify is not None:
+            data = json_loads_byteify(data)
+        return data
+    def encode_data(self, data):
+        return self.packer.pack(data)
+    def _frame(self, msg):
+        return struct.pack('>I', len(msg)) + msg
+    def encode(self, data):
+        return self._frame(self.packer.pack(data))
+    def encode_with_params(self, template, eparams):
+        pack = self.packer.pack
+        out = [self.packer.pack_map_header(len(template) + 1)]
+        for k, v in template.items():
+            out.append(pack(k))
+            out.append(pack(v))
+        out.append(pack('params'))
+        out.append(eparams)
+        return self._frame(b"".join(out))
+
+FRAMING_TYPES = {'json': JSONFraming}
+if msgpack is not None:
+    FRAMING_TYPES['msgpack'] = MsgPackFraming
+
 class WebRequestError(gcode.CommandError):
     def __init__(self, message,):
         Exception.__init__(self, message)
@@ -41,9 +110,8 @@ class Sentinel:
 
 class WebRequest:
     error = WebRequestError
-    def __init__(self, client_conn, request):
+    def __init__(self, client_conn, base_request):
         self.client_conn = client_conn
-        base_request = json.loads(request, object_hook=json_loads_byteify)
         if type(base_request) != dict:
             raise ValueError("Not a top-level dictionary")
         self.id = base_request.get('id', None)
@@ -183,8 +251,10 @@ class ClientConnection:
         self.sock = sock
         self.fd_handle = self.reactor.register_fd(
             self.sock.fileno(), self.process_received, self._do_send)
-        self.partial_data = self.send_buffer = b""
+        self.partial_data = b""
+        self.send_queue = []
         self.is_blocking = False
+        self.framing = self.pending_framing = JSONFraming()
         self.blocking_count = 0
         self.set_client_info("?", "New connection")
         self.request_log = collections.deque([], REQUEST_LOG_SIZE)
@@ -207,6 +277,15 @@ class ClientConnection:
             return
         rollover_msg = "webhooks client %s: %s" % (self.uid, repr(client_info))
         self.printer.set_rollover_info(log_id, rollover_msg, log=False)
+        if type(client_info) != dict:
+            return
+        # Select the message framing (used after the current response)
+        framing = client_info.get('framing', self.pending_framing.name)
+        if framing != self.pending_framing.name and framing in FRAMING_TYPES:
+            self.pending_framing = FRAMING_TYPES[framing]()
+
+    def get_framing(self):
+        return self.pending_framing.name
 
     def close(self):
         if self.fd_handle is None:
@@ -237,13 +316,12 @@ class ClientConnection:
             # Socket Closed
             self.close()
             return
-        requests = data.split(b'\x03')
-        requests[0] = self.partial_data + requests[0]
-        self.partial_data = requests.pop()
+        requests, self.partial_data = self.framing.split(
+            self.partial_data + data)
         for req in requests:
             self.request_log.append((eventtime, req))
             try:
-                web_request = WebRequest(self, req)
+                web_request = WebRequest(self, self.framing.decode(req))
             except Exception:
                 logging.exception("webhooks: Error decoding Server Request %s"
                                   % (req))
@@ -264,42 +342,96 @@ class ClientConnection:
             web_request.set_error(WebRequestError(str(e)))
             self.printer.invoke_shutdown(msg)
         result = web_request.finish()
-        if result is None:
-            return
-        self.send(result)
+        if result is not None:
+            self.send(result)
+        self.framing = self.pending_framing
 
-    def send(self, data):
+    def _queue_send(self, encode_func, *args):
         try:
-            jmsg = json.dumps(data, separators=(',', ':'))
-            self.send_buffer += jmsg.encode() + b"\x03"
+            self.send_queue.append(encode_func(*args))
         except (TypeError, ValueError) as e:
-            msg = ("json encoding error: %s" % (str(e),))
+            msg = ("%s encoding error: %s" % (self.framing.name, str(e)))
             logging.exception(msg)
             self.printer.invoke_shutdown(msg)
             return
         if not self.is_blocking:
             self._do_send()
 
+    def send(self, data):
+        self._queue_send(self.framing.encode, data)
+
+    def send_with_params(self, template, params, encode_cache):
+        # Send a copy of template with the given 'params'.  The encoded
+        # params are stored in encode_cache so that the same params may
+        # be sent to several clients without encoding them again.
+        framing = self.framing
+        eparams = encode_cache.get(framing.name)
+        if eparams is None:
+            try:
+                eparams = framing.encode_data(params)
+            except (TypeError, ValueError):
+                tmp = dict(template)
+                tmp['params'] = params
+                self.send(tmp)
+                return
+            encode_cache[framing.name] = eparams
+        if 'params' in template:
+            template = {k: v for k, v in template.items() if k != 'params'}
+        self._queue_send(framing.encode_with_params, template, eparams)
+
     def _do_send(self, eventtime=None):
         if self.fd_handle is None:
             return
+        send_queue = self.send_queue
+        if len(send_queue) != 1:
+            send_queue[:] = [b"".join(send_queue)]
         try:
-            sent = self.sock.send(self.send_buffer)
+            sent = self.sock.send(send_queue[0])
         except socket.error as e:
             if e.errno not in [errno.EAGAIN, errno.EWOULDBLOCK]:
                 logging.info("webhooks: socket write error %d" % (self.uid,))
                 self.close()
                 return
             sent = 0
-        if sent < len(self.send_buffer):
+        if sent < len(send_queue[0]):
             if not self.is_blocking:
                 self.reactor.set_fd_wake(self.fd_handle, False, True)
                 self.is_blocking = True
                 self.blocking_count = 5
-        elif self.is_blocking:
+            send_queue[0] = send_queue[0][sent:]
+            return
+        if self.is_blocking:
             self.reactor.set_fd_wake(self.fd_handle, True, False)
             self.is_blocking = False
-        self.send_buffer = self.send_buffer[sent:]
+        del send_queue[:]
+
+# Tracking of get_status() field changes reported by a printer object
+class StatusNotifier:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.tracked_fields = frozenset()
+        self.changed_fields = set()
+        self.changed_all = True
+    def add_tracked_fields(self, fields):
+        self.tracked_fields = self.tracked_fields.union(fields)
+    def is_tracked(self, field):
+        return field in self.tracked_fields
+    def note_change(self, fields=None):
+        # May be called from any thread
+        with self.lock:
+            if fields is None:
+                self.changed_all = True
+            else:
+                self.changed_fields.update(fields)
+    def pop_changes(self):
+        # Return the changed fields (or None if all may have changed)
+        with self.lock:
+            changed_all, changed = self.changed_all, self.changed_fields
+            self.changed_all = False
+            self.changed_fields = set()
+        if changed_all:
+            return None
+        return changed
 
 class WebHooks:
     def __init__(self, printer):
@@ -307,6 +439,7 @@ class WebHooks:
         self._endpoints = {"list_endpoints": self._handle_list_endpoints}
         self._remote_methods = {}
         self._mux_endpoints = {}
+        self._status_notifiers = {}
         self.register_endpoint("info", self._handle_info_request)
         self.register_endpoint("emergency_stop", self._handle_estop_request)
         self.register_endpoint("register_remote_method",
@@ -349,9 +482,10 @@ class WebHooks:
         web_request.send({'endpoints': list(self._endpoints.keys())})
 
     def _handle_info_request(self, web_request):
+        cconn = web_request.get_client_connection()
         client_info = web_request.get_dict('client_info', None)
         if client_info is not None:
-            web_request.get_client_connection().set_client_info(client_info)
+            cconn.set_client_info(client_info)
         state_message, state = self.printer.get_state_message()
         src_path = os.path.dirname(__file__)
         klipper_path = os.path.normpath(os.path.join(src_path, ".."))
@@ -362,7 +496,8 @@ class WebHooks:
                     'python_path': sys.executable,
                     'process_id': os.getpid(),
                     'user_id': os.getuid(),
-                    'group_id': os.getgid()}
+                    'group_id': os.getgid(),
+                    'framing': cconn.get_framing()}
         start_args = self.printer.get_start_args()
         for sa in ['log_file', 'config_file', 'software_version', 'cpu_info']:
             response[sa] = start_args.get(sa)
@@ -386,6 +521,19 @@ class WebHooks:
                      "for connection id: %d" % (method, id(new_conn)))
         self._remote_methods.setdefault(method, {})[new_conn] = template
 
+    def register_status_notifier(self, obj_name, tracked_fields):
+        # A printer object may report changes to its get_status() fields
+        # so that subscriptions only query it when needed.  Fields that
+        # are not tracked are checked on every subscription update.
+        notifier = self._status_notifiers.get(obj_name)
+        if notifier is None:
+            notifier = self._status_notifiers[obj_name] = StatusNotifier()
+        notifier.add_tracked_fields(tracked_fields)
+        return notifier
+
+    def lookup_status_notifier(self, obj_name):
+        return self._status_notifiers.get(obj_name)
+
     def get_connection(self):
         return self.sconn
 
@@ -447,13 +595,13 @@ class GCodeHelper:
     def _handle_firmware_restart(self, web_request):
         self.gcode.run_script('firmware_restart')
     def _output_callback(self, msg):
+        params = {'response': msg}
+        encode_cache = {}
         for cconn, template in list(self.clients.items()):
             if cconn.is_closed():
                 del self.clients[cconn]
                 continue
-            tmp = dict(template)
-            tmp['params'] = {'response': msg}
-            cconn.send(tmp)
+            cconn.send_with_params(template, params, encode_cache)
     def _handle_subscribe_output(self, web_request):
         cconn = web_request.get_client_connection()
         template = web_request.get_dict('response_template', {})
@@ -480,9 +628,18 @@ class QueryStatusHelper:
         objects = [n for n, o in self.printer.lookup_objects()
                    if hasattr(o, 'get_status')]
         web_request.send({'objects': objects})
+    def _get_changes(self, obj_name, last_query):
+        # Return (prev_status, notifier, changed_fields) for an object
+        webhooks = self.printer.lookup_object('webhooks')
+        notifier = webhooks.lookup_status_notifier(obj_name)
+        if notifier is None:
+            return None, None, None
+        changed = notifier.pop_changes()
+        return last_query.get(obj_name), notifier, changed
     def _do_query(self, eventtime):
         last_query = self.last_query
         query = self.last_query = {}
+        changes = {}
         msglist = self.pending_queries
         self.pending_queries = []
         msglist.extend(self.clients.values())
@@ -495,20 +652,39 @@ class QueryStatusHelper:
             # Query each requested printer object
             cquery = {}
             for obj_name, req_items in subscription.items():
+                if obj_name not in changes:
+                    changes[obj_name] = self._get_changes(obj_name, last_query)
+                prev_res, notifier, changed = changes[obj_name]
+                check_items = req_items
+                if (not is_query and req_items is not None
+                    and prev_res is not None and changed is not None):
+                    # Only check fields that may have changed
+                    check_items = [ri for ri in req_items
+                                   if ri in changed
+                                   or not notifier.is_tracked(ri)]
+                    if not check_items:
+                        continue
                 res = query.get(obj_name, None)
                 if res is None:
                     po = self.printer.lookup_object(obj_name, None)
                     if po is None or not hasattr(po, 'get_status'):
                         res = query[obj_name] = {}
                     else:
-                        res = query[obj_name] = po.get_status(eventtime)
+                        res = po.get_status(eventtime)
+                        if prev_res is not None and changed is not None:
+                            # Report unflagged fields on a later update
+                            res = {k: (prev_res[k] if k in prev_res
+                                       and k not in changed
+                                       and notifier.is_tracked(k) else v)
+                                   for k, v in res.items()}
+                        query[obj_name] = res
                 if req_items is None:
-                    req_items = list(res.keys())
+                    req_items = check_items = list(res.keys())
                     if req_items:
                         subscription[obj_name] = req_items
                 lres = last_query.get(obj_name, {})
                 cres = {}
-                for ri in req_items:
+                for ri in check_items:
                     rd = res.get(ri, None)
                     if is_query or rd != lres.get(ri):
                         cres[ri] = rd
@@ -519,7 +695,11 @@ class QueryStatusHelper:
                 tmp = dict(template)
                 tmp['params'] = {'eventtime': eventtime, 'status': cquery}
                 send_func(tmp)
-        if not query:
+        # Retain the last status of objects that did not need a query
+        for obj_name, (prev_res, notifier, changed) in changes.items():
+            if obj_name not in query and prev_res is not None:
+                query[obj_name] = prev_res
+        if not changes:
             # Unregister timer if there are no longer any subscriptions
             reactor = self.printer.get_reactor()
             reactor.unregister_timer(self.query_timer)
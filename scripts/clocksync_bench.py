@@ -0,0 +1,83 @@
+#!/usr/bin/env python3
+# Measure the host clock estimate against synthetic get_clock responses
+#
+# Copyright (C) 2026  pulponair <pulponair@users.noreply.github.com>
+#
+# This file may be distributed under the terms of the GNU GPLv3 license.
+import sys, os, optparse, random
+sys.path.append(os.path.join(os.path.dirname(os.path.realpath(__file__)),
+                             '..', 'klippy'))
+import reactor, clocksync
+
+class FakeSerial:
+    def raw_send(self, cmd, minclock, reqclock, cmd_queue):
+        pass
+    def set_clock_est(self, freq, conv_time, conv_clock, last_clock):
+        pass
+
+# Feed a ClockSync instance get_clock responses from a drifting mcu
+# clock.  Some responses are delayed before the mcu samples its clock -
+# those should not skew the estimate and should raise the query rate.
+def run_test(delayed_ratio, duration, drift, seed):
+    cs = clocksync.ClockSync(reactor.Reactor())
+    cs.serial = FakeSerial()
+    cs.mcu_freq = 72000000.
+    true_freq = cs.mcu_freq * (1. + drift)
+    def get_mcu_clock(systime):
+        return int((systime + 1234.) * true_freq)
+    start_time = systime = 100.
+    cs.last_clock = cs.clock_avg = get_mcu_clock(systime)
+    cs.time_avg = systime
+    cs.clock_est = (systime, cs.clock_avg, cs.mcu_freq)
+    cs.prediction_variance = (.001 * cs.mcu_freq)**2
+    rnd = random.Random(seed)
+    query_times = []
+    systime += .050
+    while systime < start_time + duration:
+        next_systime = cs._get_clock_event(systime)
+        query_times.append(next_systime - systime)
+        send_delay = receive_delay = .000100 + .000020 * rnd.random()
+        if rnd.random() < delayed_ratio:
+            send_delay += .005 * rnd.random()
+        receive_time = systime + send_delay + receive_delay
+        cs._handle_clock({'clock': get_mcu_clock(systime + send_delay)
+                          & 0xffffffff, '#sent_time': systime,
+                          '#receive_time': receive_time})
+        systime = next_systime
+    sample_time, clock, freq = cs.clock_est
+    clock_err = (clock + (systime - sample_time) * freq
+                 - get_mcu_clock(systime)) / true_freq
+    return clock_err, freq / true_freq - 1., min(query_times), cs
+
+def main():
+    usage = "%prog [options]"
+    opts = optparse.OptionParser(usage)
+    opts.add_option("-r", "--ratios", type="string", dest="ratios",
+                    default="0,.1,.25,.5",
+                    help="comma separated list of delayed response ratios")
+    opts.add_option("-d", "--duration", type="float", dest="duration",
+                    default=1800., help="simulated time (in seconds)")
+    opts.add_option("-f", "--drift", type="float", dest="drift",
+                    default=50., help="mcu clock drift (in ppm)")
+    opts.add_option("-s", "--seed", type="int", dest="seed",
+                    default=42, help="random seed")
+    options, args = opts.parse_args()
+    if args:
+        opts.error("Incorrect number of arguments")
+    sys.stdout.write("%8s %12s %10s %12s %10s\n"
+                     % ("delayed", "offset usec", "freq ppm",
+                        "min query", "rtt_delayed"))
+    for ratio in [float(r) for r in options.ratios.split(',')]:
+        clock_err, freq_err, query_time, cs = run_test(
+            ratio, options.duration, options.drift * .000001, options.seed)
+        sys.stdout.write("%7.0f%% %12.3f %10.4f %12.4f %10.3f\n"
+                         % (ratio * 100., clock_err * 1000000.,
+                            freq_err * 1000000., query_time,
+                            cs.delayed_ratio))
+    sys.stdout.write("Fast query rate is used above %.0f%% delayed"
+                     " responses (query time %.3fs)\n"
+                     % (clocksync.FAST_QUERY_RATIO * 100.,
+                        clocksync.FAST_QUERY_TIME))
+
+if __name__ == '__main__':
+    main()
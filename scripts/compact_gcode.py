@@ -0,0 +1,75 @@
+#!/usr/bin/env python3
+# Convert a g-code file to the compact binary format of virtual_sdcard
+#
+# Copyright (C) 2026  pulponair <pulponair@users.noreply.github.com>
+#
+# This file may be distributed under the terms of the GNU GPLv3 license.
+import sys, os, optparse, re, decimal
+sys.path.append(os.path.join(os.path.dirname(os.path.realpath(__file__)),
+                             '..', 'klippy'))
+from extras import virtual_sdcard
+
+move_r = re.compile(r'^(G0|G1)((?:\s+[XYZEF][-+]?[0-9]*\.?[0-9]*)*)\s*$',
+                    re.IGNORECASE)
+param_r = re.compile(r'([XYZEF])([-+]?[0-9]*\.?[0-9]*)', re.IGNORECASE)
+INT32_MIN, INT32_MAX = -(1 << 31), (1 << 31) - 1
+
+# Return the scaled integer parameters of a move, or None if the move
+# can not be represented exactly
+def parse_move(params):
+    values = {}
+    for name, sval in param_r.findall(params):
+        name = name.upper()
+        if name in values:
+            return None
+        scale = virtual_sdcard.BINARY_SCALES[
+            virtual_sdcard.BINARY_PARAMS.index(name)]
+        try:
+            sv = decimal.Decimal(sval) * scale
+        except decimal.InvalidOperation:
+            return None
+        if sv != sv.to_integral_value():
+            return None
+        ival = int(sv)
+        if ival < INT32_MIN or ival > INT32_MAX:
+            return None
+        values[name] = ival
+    return values
+
+def convert(infile, outfile):
+    moves = texts = 0
+    outfile.write(virtual_sdcard.BINARY_MAGIC)
+    for line in infile:
+        line = line.strip()
+        if not line or line.startswith(';'):
+            continue
+        cpos = line.find(';')
+        m = move_r.match(line[:cpos] if cpos >= 0 else line)
+        if m is not None:
+            values = parse_move(m.group(2))
+            if values is not None:
+                outfile.write(virtual_sdcard.encode_binary_move(
+                    m.group(1).upper(), values))
+                moves += 1
+                continue
+        outfile.write(virtual_sdcard.encode_binary_text(line))
+        texts += 1
+    return moves, texts
+
+def main():
+    usage = "%prog [options] <input.gcode> <output.kgc>"
+    opts = optparse.OptionParser(usage)
+    options, args = opts.parse_args()
+    if len(args) != 2:
+        opts.error("Incorrect number of arguments")
+    with open(args[0], 'r') as infile:
+        with open(args[1], 'wb') as outfile:
+            moves, texts = convert(infile, outfile)
+    insize = os.path.getsize(args[0])
+    outsize = os.path.getsize(args[1])
+    sys.stdout.write("Converted %d moves and %d text commands"
+                     " (%d bytes -> %d bytes)\n"
+                     % (moves, texts, insize, outsize))
+
+if __name__ == '__main__':
+    main()
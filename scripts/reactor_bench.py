@@ -0,0 +1,61 @@
+#!/usr/bin/env python3
+# Measure reactor timer dispatch overhead versus the number of timers
+#
+# Copyright (C) 2026  pulponair <pulponair@users.noreply.github.com>
+#
+# This file may be distributed under the terms of the GNU GPLv3 license.
+import sys, os, optparse, random
+sys.path.append(os.path.join(os.path.dirname(os.path.realpath(__file__)),
+                             '..', 'klippy'))
+import reactor
+
+# Run a reactor with one "busy" timer that is rescheduled for
+# immediate dispatch on every pass, along with a number of idle
+# periodic timers (similar to heater, fan, and sensor checks).
+def run_test(timer_count, duration, period):
+    r = reactor.Reactor()
+    stats = {'busy': 0, 'idle': 0}
+    def busy_callback(eventtime):
+        stats['busy'] += 1
+        return r.NOW
+    def idle_callback(eventtime):
+        stats['idle'] += 1
+        return eventtime + period
+    def end_callback(eventtime):
+        r.end()
+        return r.NEVER
+    start_time = r.monotonic()
+    for i in range(timer_count - 1):
+        r.register_timer(idle_callback, start_time + random.uniform(0, period))
+    r.register_timer(busy_callback, r.NOW)
+    r.register_timer(end_callback, start_time + duration)
+    r.run()
+    r.finalize()
+    total_time = r.monotonic() - start_time
+    return stats['busy'] / total_time, stats['idle'] / total_time
+
+def main():
+    usage = "%prog [options]"
+    opts = optparse.OptionParser(usage)
+    opts.add_option("-c", "--counts", type="string", dest="counts",
+                    default="1,10,30,100,300,1000",
+                    help="comma separated list of timer counts to test")
+    opts.add_option("-d", "--duration", type="float", dest="duration",
+                    default=2., help="duration of each test (in seconds)")
+    opts.add_option("-p", "--period", type="float", dest="period",
+                    default=0.100, help="wake period of the idle timers")
+    options, args = opts.parse_args()
+    if args:
+        opts.error("Incorrect number of arguments")
+    random.seed(0)
+    sys.stdout.write("%8s %14s %14s %12s\n"
+                     % ("timers", "dispatch/sec", "idle wake/sec",
+                        "usec/dispatch"))
+    for count in [int(c) for c in options.counts.split(',')]:
+        busy_rate, idle_rate = run_test(max(1, count), options.duration,
+                                        options.period)
+        sys.stdout.write("%8d %14.0f %14.0f %12.3f\n"
+                         % (count, busy_rate, idle_rate, 1000000. / busy_rate))
+
+if __name__ == '__main__':
+    main()
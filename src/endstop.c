@@ -4,25 +4,54 @@
 //
 // This file may be distributed under the terms of the GNU GPLv3 license.
 
+#include <string.h> // memcpy
 #include "basecmd.h" // oid_alloc
 #include "board/gpio.h" // struct gpio
 #include "board/irq.h" // irq_disable
+#include "board/misc.h" // timer_is_before
 #include "command.h" // DECL_COMMAND
 #include "sched.h" // struct timer
 #include "trsync.h" // trsync_do_trigger
 
+#define MAX_TAPS 8
+
 struct endstop {
     struct timer time;
     struct gpio_in pin;
     uint32_t rest_time, sample_time, nextwake;
     struct trsync *ts;
     uint8_t flags, sample_count, trigger_count, trigger_reason;
+    // Tap recording
+    uint8_t tap_count;
+    uint32_t hold_time, taps[MAX_TAPS];
 };
 
-enum { ESF_PIN_HIGH=1<<0, ESF_HOMING=1<<1 };
+enum { ESF_PIN_HIGH=1<<0, ESF_HOMING=1<<1, ESF_TAP=1<<2, ESF_RELEASE=1<<3 };
+
+DECL_CONSTANT("ENDSTOP_MAX_TAPS", MAX_TAPS);
 
+static uint_fast8_t endstop_event(struct timer *t);
 static uint_fast8_t endstop_oversample_event(struct timer *t);
 
+// Note a tap (or the release after a tap) and wait for the next change
+static uint_fast8_t
+endstop_tap_event(struct endstop *e)
+{
+    uint8_t flags = e->flags;
+    if (!(flags & ESF_RELEASE)) {
+        if (e->tap_count >= MAX_TAPS) {
+            trsync_do_trigger(e->ts, e->trigger_reason);
+            return SF_DONE;
+        }
+        e->taps[e->tap_count++] = e->nextwake - e->rest_time;
+    }
+    e->flags = flags ^ (ESF_PIN_HIGH | ESF_RELEASE);
+    e->time.func = endstop_event;
+    e->time.waketime = e->nextwake;
+    e->trigger_count = e->sample_count;
+    return SF_RESCHEDULE;
+}
+
 // Timer callback for an end stop
 static uint_fast8_t
 endstop_event(struct timer *t)
@@ -31,6 +60,13 @@ endstop_event(struct timer *t)
     uint8_t val = gpio_in_read(e->pin);
     uint32_t nextwake = e->time.waketime + e->rest_time;
     if ((val ? ~e->flags : e->flags) & ESF_PIN_HIGH) {
+        if (e->flags & ESF_RELEASE
+            && !timer_is_before(e->time.waketime
+                                , e->taps[e->tap_count - 1] + e->hold_time)) {
+            // Probe did not release after a tap - stop the move
+            trsync_do_trigger(e->ts, e->trigger_reason);
+            return SF_DONE;
+        }
         // No match - reschedule for the next attempt
         e->time.waketime = nextwake;
         return SF_RESCHEDULE;
@@ -55,6 +91,8 @@ endstop_oversample_event(struct timer *t)
     }
     uint8_t count = e->trigger_count - 1;
     if (!count) {
+        if (e->flags & ESF_TAP)
+            return endstop_tap_event(e);
         trsync_do_trigger(e->ts, e->trigger_reason);
         return SF_DONE;
     }
@@ -98,6 +136,51 @@ DECL_COMMAND(command_endstop_home,
              "endstop_home oid=%c clock=%u sample_ticks=%u sample_count=%c"
              " rest_ticks=%u pin_value=%c trsync_oid=%c trigger_reason=%c");
 
+// Record the time of each probe tap without stopping the move.  The
+// move is only stopped if the pin stays triggered for longer than
+// hold_ticks (or if there are more than MAX_TAPS taps).
+void
+command_endstop_tap(uint32_t *args)
+{
+    struct endstop *e = oid_lookup(args[0], command_config_endstop);
+    sched_del_timer(&e->time);
+    e->time.waketime = args[1];
+    e->sample_time = args[2];
+    e->sample_count = args[3];
+    if (!e->sample_count)
+        shutdown("Invalid endstop tap sample_count");
+    e->rest_time = args[4];
+    e->time.func = endstop_event;
+    e->trigger_count = e->sample_count;
+    e->flags = ESF_HOMING | ESF_TAP | (args[5] ? ESF_PIN_HIGH : 0);
+    e->hold_time = args[6];
+    e->tap_count = 0;
+    e->ts = trsync_oid_lookup(args[7]);
+    e->trigger_reason = args[8];
+    sched_add_timer(&e->time);
+}
+DECL_COMMAND(command_endstop_tap,
+             "endstop_tap oid=%c clock=%u sample_ticks=%u sample_count=%c"
+             " rest_ticks=%u pin_value=%c hold_ticks=%u trsync_oid=%c"
+             " trigger_reason=%c");
+
+void
+command_endstop_query_taps(uint32_t *args)
+{
+    uint8_t oid = args[0];
+    struct endstop *e = oid_lookup(oid, command_config_endstop);
+    uint32_t taps[MAX_TAPS];
+
+    irq_disable();
+    uint8_t count = e->tap_count;
+    memcpy(taps, e->taps, sizeof(taps));
+    irq_enable();
+
+    sendf("endstop_taps oid=%c count=%c clocks=%*s"
+          , oid, count, (int)(count * sizeof(taps[0])), (uint8_t*)taps);
+}
+DECL_COMMAND(command_endstop_query_taps, "endstop_query_taps oid=%c");
+
 void
 command_endstop_query_state(uint32_t *args)
 {
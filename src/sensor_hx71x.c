@@ -12,6 +12,7 @@
 #include "command.h" // DECL_COMMAND
 #include "sched.h" // sched_add_timer
 #include "sensor_bulk.h" // sensor_bulk_report
+#include "trsync.h" // trsync_do_trigger
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -24,12 +25,26 @@ struct hx71x_adc {
     struct gpio_in dout; // pin used to receive data from the hx71x
     struct gpio_out sclk; // pin used to generate clock for the hx71x
     struct sensor_bulk sb;
+    // homing
+    struct trsync *ts;
+    uint8_t homing_flags;
+    uint8_t trigger_reason, error_reason;
+    uint8_t tare_samples, tare_count, filter_shift;
+    uint32_t homing_clock, trigger_force, trigger_slope;
+    int32_t tare_sum, tare, filter_accum, last_force;
 };
 
 enum {
     HX_PENDING = 1<<0, HX_OVERFLOW = 1<<1,
 };
 
+enum {
+    HH_CAN_TRIGGER = 1<<0, HH_AWAIT_HOMING = 1<<1, HH_TARE = 1<<2,
+};
+
+#define MAX_TARE_SAMPLES 32
+#define MAX_FILTER_SHIFT 6
+
 #define BYTES_PER_SAMPLE 4
 #define SAMPLE_ERROR_DESYNC 1L << 31
 #define SAMPLE_ERROR_READ_TOO_LONG 1L << 30
@@ -141,6 +156,73 @@ add_sample(struct hx71x_adc *hx71x, uint8_t oid, uint32_t counts,
         sensor_bulk_report(&hx71x->sb, oid);
 }
 
+
+/****************************************************************
+ * Probing support
+ ****************************************************************/
+
+// Notify trsync of event
+static void
+notify_trigger(struct hx71x_adc *hx71x, uint32_t time, uint8_t reason)
+{
+    hx71x->homing_flags = 0;
+    hx71x->homing_clock = time;
+    trsync_do_trigger(hx71x->ts, reason);
+}
+
+// Check if a sample should trigger a homing event.  The first
+// samples after the homing start time are averaged to tare the
+// sensor, after which the force (relative to the tare) is passed
+// through an exponential low pass filter.  The probe triggers when
+// the filtered force exceeds the threshold while still rising.
+static void
+check_home(struct hx71x_adc *hx71x, int32_t counts, uint32_t error)
+{
+    uint8_t homing_flags = hx71x->homing_flags;
+    if (!(homing_flags & HH_CAN_TRIGGER))
+        return;
+    uint32_t time = timer_read_time();
+    if (error) {
+        // Sensor reports an issue - cancel homing
+        notify_trigger(hx71x, time, hx71x->error_reason);
+        return;
+    }
+    if (homing_flags & HH_AWAIT_HOMING) {
+        if (timer_is_before(time, hx71x->homing_clock))
+            return;
+        homing_flags &= ~HH_AWAIT_HOMING;
+        hx71x->homing_flags = homing_flags;
+    }
+    if (homing_flags & HH_TARE) {
+        hx71x->tare_sum += counts;
+        if (++hx71x->tare_count < hx71x->tare_samples)
+            return;
+        hx71x->tare = hx71x->tare_sum / hx71x->tare_samples;
+        hx71x->filter_accum = hx71x->last_force = 0;
+        hx71x->homing_flags = homing_flags & ~HH_TARE;
+        return;
+    }
+    // Low pass filter (the accumulator holds the force << filter_shift)
+    int32_t divisor = 1L << hx71x->filter_shift;
+    hx71x->filter_accum += (counts - hx71x->tare)
+                           - hx71x->filter_accum / divisor;
+    int32_t force = hx71x->filter_accum / divisor;
+    int32_t slope = force - hx71x->last_force;
+    hx71x->last_force = force;
+    if (force < 0) {
+        force = -force;
+        slope = -slope;
+    }
+    if (force >= (int32_t)hx71x->trigger_force
+        && slope >= (int32_t)hx71x->trigger_slope)
+        notify_trigger(hx71x, time, hx71x->trigger_reason);
+}
+
+
+/****************************************************************
+ * Sample reading
+ ****************************************************************/
+
 // hx71x ADC query
 static void
 hx71x_read_adc(struct hx71x_adc *hx71x, uint8_t oid)
@@ -175,6 +257,9 @@ hx71x_read_adc(struct hx71x_adc *hx71x, uint8_t oid)
         counts = hx71x->last_error;
     }
 
+    // Check for endstop trigger
+    check_home(hx71x, counts, hx71x->last_error);
+
     // Add measurement to buffer
     add_sample(hx71x, oid, counts, false);
 }
@@ -237,6 +322,47 @@ command_query_hx71x_status(const uint32_t *args)
 }
 DECL_COMMAND(command_query_hx71x_status, "query_hx71x_status oid=%c");
 
+void
+command_hx71x_setup_home(uint32_t *args)
+{
+    struct hx71x_adc *hx71x = oid_lookup(args[0], command_config_hx71x);
+    hx71x->trigger_force = args[2];
+    if (!hx71x->trigger_force) {
+        hx71x->ts = NULL;
+        hx71x->homing_flags = 0;
+        return;
+    }
+    uint8_t tare_samples = args[4], filter_shift = args[5];
+    if (!tare_samples || tare_samples > MAX_TARE_SAMPLES
+        || filter_shift > MAX_FILTER_SHIFT)
+        shutdown("Invalid hx71x homing parameters");
+    hx71x->homing_clock = args[1];
+    hx71x->trigger_slope = args[3];
+    hx71x->tare_samples = tare_samples;
+    hx71x->filter_shift = filter_shift;
+    hx71x->ts = trsync_oid_lookup(args[6]);
+    hx71x->trigger_reason = args[7];
+    hx71x->error_reason = args[8];
+    hx71x->tare_count = 0;
+    hx71x->tare_sum = 0;
+    hx71x->homing_flags = HH_CAN_TRIGGER | HH_AWAIT_HOMING | HH_TARE;
+}
+DECL_COMMAND(command_hx71x_setup_home,
+             "hx71x_setup_home oid=%c clock=%u trigger_force=%u"
+             " trigger_slope=%u tare_samples=%c filter_shift=%c"
+             " trsync_oid=%c trigger_reason=%c error_reason=%c");
+
+void
+command_query_hx71x_home_state(uint32_t *args)
+{
+    struct hx71x_adc *hx71x = oid_lookup(args[0], command_config_hx71x);
+    sendf("hx71x_home_state oid=%c homing=%c trigger_clock=%u tare=%i"
+          , args[0], !!(hx71x->homing_flags & HH_CAN_TRIGGER)
+          , hx71x->homing_clock, hx71x->tare);
+}
+DECL_COMMAND(command_query_hx71x_home_state,
+             "query_hx71x_home_state oid=%c");
+
 // Background task that performs measurements
 void
 hx71x_capture_task(void)
@@ -24,9 +24,23 @@ struct tmcuart_s {
 
 enum {
     TU_LINE_HIGH = 1<<0, TU_ACTIVE = 1<<1, TU_READ_SYNC = 1<<2,
-    TU_REPORT = 1<<3, TU_PULLUP = 1<<4, TU_SINGLE_WIRE = 1<<5
+    TU_REPORT = 1<<3, TU_PULLUP = 1<<4, TU_SINGLE_WIRE = 1<<5,
+    TU_BATCH = 1<<6
 };
 
+// Batched transmissions.  The host serializes all tmcuart requests on
+// an mcu, so a single buffer (holding up to four register reads) is
+// shared by all uarts.
+#define TMCUART_BATCH_SIZE 40
+
+static struct {
+    struct tmcuart_s *owner;
+    uint8_t pos, len, read_len, result_len;
+    uint8_t data[TMCUART_BATCH_SIZE], result[TMCUART_BATCH_SIZE];
+} tmcuart_batch;
+
+DECL_CONSTANT("TMCUART_BATCH_SIZE", TMCUART_BATCH_SIZE);
+
 static struct task_wake tmcuart_wake;
 
 // Restore uart line to normal "idle" mode
@@ -40,12 +54,37 @@ tmcuart_reset_line(struct tmcuart_s *t)
     t->flags = (t->flags & (TU_PULLUP | TU_SINGLE_WIRE)) | TU_LINE_HIGH;
 }
 
+static void tmcuart_setup_send(struct tmcuart_s *t, uint8_t *write
+                               , uint8_t write_len, uint8_t read_len);
+
 // Helper function to end a transmission and schedule a response
 static uint_fast8_t
 tmcuart_finalize(struct tmcuart_s *t)
 {
+    uint8_t batch = t->flags & TU_BATCH;
+    if (batch) {
+        // Store the response (all zeros on a read timeout)
+        uint8_t read_len = tmcuart_batch.read_len;
+        uint8_t *result = &tmcuart_batch.result[tmcuart_batch.result_len];
+        if (t->read_count)
+            memcpy(result, t->data, read_len);
+        else
+            memset(result, 0, read_len);
+        tmcuart_batch.result_len += read_len;
+        if (tmcuart_batch.pos < tmcuart_batch.len) {
+            // Start the next transmission in the batch
+            tmcuart_reset_line(t);
+            t->flags |= TU_ACTIVE | TU_BATCH;
+            uint8_t *entry = &tmcuart_batch.data[tmcuart_batch.pos];
+            tmcuart_batch.pos += 2 + entry[0];
+            tmcuart_batch.read_len = entry[1];
+            tmcuart_setup_send(t, &entry[2], entry[0], entry[1]);
+            t->timer.waketime += timer_from_us(200);
+            return SF_RESCHEDULE;
+        }
+    }
     tmcuart_reset_line(t);
-    t->flags |= TU_REPORT;
+    t->flags |= TU_REPORT | batch;
     sched_wake_task(&tmcuart_wake);
     return SF_DONE;
 }
@@ -186,6 +225,23 @@ DECL_COMMAND(command_config_tmcuart,
              "config_tmcuart oid=%c rx_pin=%u pull_up=%c"
              " tx_pin=%u bit_time=%u");
 
+// Prepare the timer to transmit a message
+static void
+tmcuart_setup_send(struct tmcuart_s *t, uint8_t *write, uint8_t write_len
+                   , uint8_t read_len)
+{
+    memcpy(t->data, write, write_len);
+    t->pos = 0;
+    t->write_count = write_len * 8;
+    t->read_count = read_len * 8;
+    if (write_len >= 1 && (t->data[0] & 0x3f) == 0x2a) {
+        t->timer.func = tmcuart_send_sync_event;
+    } else {
+        t->bit_time = t->cfg_bit_time;
+        t->timer.func = tmcuart_send_event;
+    }
+}
+
 // Parse and schedule a TMC UART transmission request
 void
 command_tmcuart_send(uint32_t *args)
@@ -199,17 +255,8 @@ command_tmcuart_send(uint32_t *args)
     uint8_t read_len = args[3];
     if (write_len > sizeof(t->data) || read_len > sizeof(t->data))
         shutdown("tmcuart data too large");
-    memcpy(t->data, write, write_len);
-    t->pos = 0;
     t->flags = (t->flags & (TU_LINE_HIGH|TU_PULLUP|TU_SINGLE_WIRE)) | TU_ACTIVE;
-    t->write_count = write_len * 8;
-    t->read_count = read_len * 8;
-    if (write_len >= 1 && (t->data[0] & 0x3f) == 0x2a) {
-        t->timer.func = tmcuart_send_sync_event;
-    } else {
-        t->bit_time = t->cfg_bit_time;
-        t->timer.func = tmcuart_send_event;
-    }
+    tmcuart_setup_send(t, write, write_len, read_len);
     irq_disable();
     t->timer.waketime = timer_read_time() + timer_from_us(200);
     sched_add_timer(&t->timer);
@@ -217,6 +264,49 @@ command_tmcuart_send(uint32_t *args)
 }
 DECL_COMMAND(command_tmcuart_send, "tmcuart_send oid=%c write=%*s read=%c");
 
+// Schedule several TMC UART transmissions (each encoded as write_len,
+// read_len, write data) and report all responses in one message
+void
+command_tmcuart_send_batch(uint32_t *args)
+{
+    struct tmcuart_s *t = oid_lookup(args[0], command_config_tmcuart);
+    struct tmcuart_s *owner = tmcuart_batch.owner;
+    if (t->flags & TU_ACTIVE || (owner && owner->flags & TU_BATCH))
+        // Uart or batch buffer is busy - silently drop this request
+        return;
+    uint8_t batch_len = args[1];
+    uint8_t *batch = command_decode_ptr(args[2]);
+    if (batch_len > sizeof(tmcuart_batch.data))
+        shutdown("tmcuart data too large");
+    // Validate the batch
+    uint_fast8_t pos = 0, result_len = 0;
+    while (pos < batch_len) {
+        uint8_t *entry = &batch[pos];
+        if (pos + 2 > batch_len || pos + 2 + entry[0] > batch_len
+            || !entry[0] || entry[0] > sizeof(t->data)
+            || entry[1] > sizeof(t->data))
+            shutdown("Invalid tmcuart batch");
+        result_len += entry[1];
+        pos += 2 + entry[0];
+    }
+    if (!batch_len || result_len > sizeof(tmcuart_batch.result))
+        shutdown("Invalid tmcuart batch");
+    memcpy(tmcuart_batch.data, batch, batch_len);
+    tmcuart_batch.owner = t;
+    tmcuart_batch.len = batch_len;
+    tmcuart_batch.pos = 2 + batch[0];
+    tmcuart_batch.read_len = batch[1];
+    tmcuart_batch.result_len = 0;
+    t->flags = ((t->flags & (TU_LINE_HIGH|TU_PULLUP|TU_SINGLE_WIRE))
+                | TU_ACTIVE | TU_BATCH);
+    tmcuart_setup_send(t, &tmcuart_batch.data[2], batch[0], batch[1]);
+    irq_disable();
+    t->timer.waketime = timer_read_time() + timer_from_us(200);
+    sched_add_timer(&t->timer);
+    irq_enable();
+}
+DECL_COMMAND(command_tmcuart_send_batch, "tmcuart_send_batch oid=%c write=%*s");
+
 // Report completed response message back to host
 void
 tmcuart_task(void)
@@ -229,10 +319,15 @@ tmcuart_task(void)
         if (!(t->flags & TU_REPORT))
             continue;
         irq_disable();
-        t->flags &= ~TU_REPORT;
+        uint8_t flags = t->flags;
+        t->flags &= ~(TU_REPORT | TU_BATCH);
         irq_enable();
-        sendf("tmcuart_response oid=%c read=%*s"
-              , oid, t->read_count / 8, t->data);
+        if (flags & TU_BATCH)
+            sendf("tmcuart_batch_response oid=%c read=%*s"
+                  , oid, tmcuart_batch.result_len, tmcuart_batch.result);
+        else
+            sendf("tmcuart_response oid=%c read=%*s"
+                  , oid, t->read_count / 8, t->data);
     }
 }
 DECL_TASK(tmcuart_task);
@@ -245,5 +340,6 @@ tmcuart_shutdown(void)
     foreach_oid(i, t, command_config_tmcuart) {
         tmcuart_reset_line(t);
     }
+    tmcuart_batch.owner = NULL;
 }
 DECL_SHUTDOWN(tmcuart_shutdown);
@@ -14,7 +14,7 @@
 
 struct trsync {
     struct timer report_time, expire_time;
-    uint32_t report_ticks;
+    uint32_t report_ticks, trigger_clock;
     struct trsync_signal *signals;
     uint8_t flags, trigger_reason, expire_reason;
 };
@@ -32,6 +32,7 @@ trsync_do_trigger(struct trsync *ts, uint8_t reason)
     if (!(flags & TSF_CAN_TRIGGER))
         goto done;
     ts->trigger_reason = reason;
+    ts->trigger_clock = timer_read_time();
     ts->flags = (flags & ~TSF_CAN_TRIGGER) | TSF_REPORT;
     // Dispatch signals
     while (ts->signals) {
@@ -112,6 +113,7 @@ trsync_clear(struct trsync *ts)
     }
     ts->signals = NULL;
     ts->flags = ts->trigger_reason = ts->expire_reason = 0;
+    ts->trigger_clock = 0;
 }
 
 void
@@ -165,8 +167,9 @@ command_trsync_trigger(uint32_t *args)
     sched_del_timer(&ts->expire_time);
     ts->flags = 0;
     uint8_t trigger_reason = ts->trigger_reason;
+    uint32_t trigger_clock = ts->trigger_clock;
     irq_enable();
-    trsync_report(oid, 0, trigger_reason, 0);
+    trsync_report(oid, 0, trigger_reason, trigger_clock);
 }
 DECL_COMMAND(command_trsync_trigger, "trsync_trigger oid=%c reason=%c");
 
@@ -184,6 +187,9 @@ trsync_task(void)
         irq_disable();
         uint8_t trigger_reason = ts->trigger_reason, flags = ts->flags;
         ts->flags = flags & ~TSF_REPORT;
+        if (!(flags & TSF_CAN_TRIGGER))
+            // Report the time the trigger occurred
+            time = ts->trigger_clock;
         irq_enable();
 
         trsync_report(oid, flags, trigger_reason, time);
@@ -0,0 +1,189 @@
+; Input for sdcard_binary.test
+
+G28
+SDCARD_LOOP_DESIST
+SDCARD_PRINT_FILE FILENAME=big.kgc
+; Batch mode exits at the end of this input, and the print only runs
+; once the input is read past its first 4096 byte block.  Poll the
+; print status until then so the binary records are decoded and run.
+M27 ; This is line 0
+M27 ; This is line 1
+M27 ; This is line 2
+M27 ; This is line 3
+M27 ; This is line 4
+M27 ; This is line 5
+M27 ; This is line 6
+M27 ; This is line 7
+M27 ; This is line 8
+M27 ; This is line 9
+M27 ; This is line 10
+M27 ; This is line 11
+M27 ; This is line 12
+M27 ; This is line 13
+M27 ; This is line 14
+M27 ; This is line 15
+M27 ; This is line 16
+M27 ; This is line 17
+M27 ; This is line 18
+M27 ; This is line 19
+M27 ; This is line 20
+M27 ; This is line 21
+M27 ; This is line 22
+M27 ; This is line 23
+M27 ; This is line 24
+M27 ; This is line 25
+M27 ; This is line 26
+M27 ; This is line 27
+M27 ; This is line 28
+M27 ; This is line 29
+M27 ; This is line 30
+M27 ; This is line 31
+M27 ; This is line 32
+M27 ; This is line 33
+M27 ; This is line 34
+M27 ; This is line 35
+M27 ; This is line 36
+M27 ; This is line 37
+M27 ; This is line 38
+M27 ; This is line 39
+M27 ; This is line 40
+M27 ; This is line 41
+M27 ; This is line 42
+M27 ; This is line 43
+M27 ; This is line 44
+M27 ; This is line 45
+M27 ; This is line 46
+M27 ; This is line 47
+M27 ; This is line 48
+M27 ; This is line 49
+M27 ; This is line 50
+M27 ; This is line 51
+M27 ; This is line 52
+M27 ; This is line 53
+M27 ; This is line 54
+M27 ; This is line 55
+M27 ; This is line 56
+M27 ; This is line 57
+M27 ; This is line 58
+M27 ; This is line 59
+M27 ; This is line 60
+M27 ; This is line 61
+M27 ; This is line 62
+M27 ; This is line 63
+M27 ; This is line 64
+M27 ; This is line 65
+M27 ; This is line 66
+M27 ; This is line 67
+M27 ; This is line 68
+M27 ; This is line 69
+M27 ; This is line 70
+M27 ; This is line 71
+M27 ; This is line 72
+M27 ; This is line 73
+M27 ; This is line 74
+M27 ; This is line 75
+M27 ; This is line 76
+M27 ; This is line 77
+M27 ; This is line 78
+M27 ; This is line 79
+M27 ; This is line 80
+M27 ; This is line 81
+M27 ; This is line 82
+M27 ; This is line 83
+M27 ; This is line 84
+M27 ; This is line 85
+M27 ; This is line 86
+M27 ; This is line 87
+M27 ; This is line 88
+M27 ; This is line 89
+M27 ; This is line 90
+M27 ; This is line 91
+M27 ; This is line 92
+M27 ; This is line 93
+M27 ; This is line 94
+M27 ; This is line 95
+M27 ; This is line 96
+M27 ; This is line 97
+M27 ; This is line 98
+M27 ; This is line 99
+M27 ; This is line 100
+M27 ; This is line 101
+M27 ; This is line 102
+M27 ; This is line 103
+M27 ; This is line 104
+M27 ; This is line 105
+M27 ; This is line 106
+M27 ; This is line 107
+M27 ; This is line 108
+M27 ; This is line 109
+M27 ; This is line 110
+M27 ; This is line 111
+M27 ; This is line 112
+M27 ; This is line 113
+M27 ; This is line 114
+M27 ; This is line 115
+M27 ; This is line 116
+M27 ; This is line 117
+M27 ; This is line 118
+M27 ; This is line 119
+M27 ; This is line 120
+M27 ; This is line 121
+M27 ; This is line 122
+M27 ; This is line 123
+M27 ; This is line 124
+M27 ; This is line 125
+M27 ; This is line 126
+M27 ; This is line 127
+M27 ; This is line 128
+M27 ; This is line 129
+M27 ; This is line 130
+M27 ; This is line 131
+M27 ; This is line 132
+M27 ; This is line 133
+M27 ; This is line 134
+M27 ; This is line 135
+M27 ; This is line 136
+M27 ; This is line 137
+M27 ; This is line 138
+M27 ; This is line 139
+M27 ; This is line 140
+M27 ; This is line 141
+M27 ; This is line 142
+M27 ; This is line 143
+M27 ; This is line 144
+M27 ; This is line 145
+M27 ; This is line 146
+M27 ; This is line 147
+M27 ; This is line 148
+M27 ; This is line 149
+M27 ; This is line 150
+M27 ; This is line 151
+M27 ; This is line 152
+M27 ; This is line 153
+M27 ; This is line 154
+M27 ; This is line 155
+M27 ; This is line 156
+M27 ; This is line 157
+M27 ; This is line 158
+M27 ; This is line 159
+M27 ; This is line 160
+M27 ; This is line 161
+M27 ; This is line 162
+M27 ; This is line 163
+M27 ; This is line 164
+M27 ; This is line 165
+M27 ; This is line 166
+M27 ; This is line 167
+M27 ; This is line 168
+M27 ; This is line 169
+M27 ; This is line 170
+M27 ; This is line 171
+M27 ; This is line 172
+M27 ; This is line 173
+M27 ; This is line 174
+M27 ; This is line 175
+M27 ; This is line 176
+M27 ; This is line 177
+M27 ; This is line 178
+M27 ; This is line 179
+M400
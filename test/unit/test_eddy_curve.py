@@ -0,0 +1,66 @@
+# Tests for the eddy current frequency to height conversion
+#
+# Copyright (C) 2026  pulponair <pulponair@users.noreply.github.com>
+#
+# This file may be distributed under the terms of the GNU GPLv3 license.
+import sys, os, unittest
+sys.path.append(os.path.join(os.path.dirname(os.path.realpath(__file__)),
+                             '..', '..', 'klippy'))
+import chelper
+
+OUT_OF_RANGE = 99.9
+
+class TestEddyCurve(unittest.TestCase):
+    def make_curve(self, cal):
+        ffi_main, ffi_lib = chelper.get_ffi()
+        curve = ffi_main.gc(ffi_lib.eddy_curve_alloc(),
+                            ffi_lib.eddy_curve_free)
+        freqs = [f for f, z in cal]
+        zpos = [z for f, z in cal]
+        res = ffi_lib.eddy_curve_set(curve, len(cal), freqs, zpos,
+                                     OUT_OF_RANGE)
+        self.assertEqual(res, 0)
+        return ffi_lib, curve
+    def test_linear(self):
+        # Evenly spaced collinear points give a straight line
+        ffi_lib, curve = self.make_curve(
+            [(1000., 4.), (2000., 3.), (3000., 2.), (4000., 1.)])
+        for freq, height in [(1000., 4.), (1500., 3.5), (2250., 2.75),
+                             (3999., 1.001)]:
+            self.assertAlmostEqual(
+                ffi_lib.eddy_curve_freq_to_height(curve, freq), height,
+                places=6)
+    def test_spline(self):
+        ffi_lib, curve = self.make_curve(
+            [(1000., 3.), (2000., 2.5), (4000., 0.)])
+        # Calibration points are reproduced, and the spline bends
+        # between them (a linear interpolation gives 2.75 at 1500Hz and
+        # 1.875 at 2500Hz)
+        expected = [(1000., 3.), (1500., 2.772727), (2000., 2.5),
+                    (2500., 2.034801), (3000., 1.392045), (3500., .678267)]
+        freqs = [f for f, z in expected]
+        ffi_main, ffi_lib = chelper.get_ffi()
+        heights = ffi_main.new('double[]', len(freqs))
+        ffi_lib.eddy_curve_freq_to_height_batch(curve, len(freqs), freqs,
+                                                heights)
+        for (freq, height), batch_height in zip(expected, heights):
+            single_height = ffi_lib.eddy_curve_freq_to_height(curve, freq)
+            self.assertAlmostEqual(single_height, height, places=6)
+            self.assertEqual(batch_height, single_height)
+        # The inverse conversion returns the frequencies
+        for freq, height in expected:
+            self.assertAlmostEqual(
+                ffi_lib.eddy_curve_height_to_freq(curve, height), freq,
+                delta=.01)
+    def test_out_of_range(self):
+        ffi_lib, curve = self.make_curve(
+            [(1000., 3.), (2000., 2.5), (4000., 0.)])
+        self.assertEqual(ffi_lib.eddy_curve_freq_to_height(curve, 999.),
+                         OUT_OF_RANGE)
+        self.assertEqual(ffi_lib.eddy_curve_freq_to_height(curve, 4000.),
+                         -OUT_OF_RANGE)
+        self.assertLess(ffi_lib.eddy_curve_height_to_freq(curve, 3.5), 0.)
+        self.assertLess(ffi_lib.eddy_curve_height_to_freq(curve, -.1), 0.)
+
+if __name__ == '__main__':
+    unittest.main()
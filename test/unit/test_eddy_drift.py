@@ -0,0 +1,83 @@
+# Tests for the eddy current drift compensation table
+#
+# Copyright (C) 2026  pulponair <pulponair@users.noreply.github.com>
+#
+# This file may be distributed under the terms of the GNU GPLv3 license.
+import sys, os, unittest
+sys.path.append(os.path.join(os.path.dirname(os.path.realpath(__file__)),
+                             '..', '..', 'klippy'))
+import chelper
+from extras import temperature_probe
+
+Polynomial2d = temperature_probe.Polynomial2d
+
+# Drift curves (frequency versus temperature), highest frequency first
+LINEAR_CURVES = [Polynomial2d(3000000., -100., 0.),
+                 Polynomial2d(2900000., -80., 0.),
+                 Polynomial2d(2800000., -60., 0.)]
+LINEAR_MIN_FREQ = 2792800.
+
+class TestEddyDrift(unittest.TestCase):
+    def make_table(self, curves, min_freq):
+        temp_count, table = temperature_probe.sample_drift_curves(curves,
+                                                                  150.)
+        ffi_main, ffi_lib = chelper.get_ffi()
+        drift = ffi_main.gc(ffi_lib.eddy_drift_alloc(),
+                            ffi_lib.eddy_drift_free)
+        res = ffi_lib.eddy_drift_set_table(
+            drift, len(curves), temp_count, table, 0.,
+            temperature_probe.DRIFT_TABLE_STEP, min_freq)
+        self.assertEqual(res, 0)
+        return drift
+    def calc_freqs(self, drift, freqs, origin_temp, dest_temp):
+        ffi_main, ffi_lib = chelper.get_ffi()
+        out = ffi_main.new('double[]', len(freqs))
+        res = ffi_lib.eddy_drift_calc_freqs(drift, len(freqs), freqs, out,
+                                            origin_temp, dest_temp)
+        self.assertEqual(res, 0)
+        return list(out)
+    def test_sample_curves(self):
+        curves = [Polynomial2d(3000000., -100., .5),
+                  Polynomial2d(2900000., -80., .4)]
+        temp_count, table = temperature_probe.sample_drift_curves(curves,
+                                                                  150.)
+        self.assertEqual(temp_count, 301)
+        self.assertEqual(len(table), 2 * 301)
+        self.assertEqual(table[0:2], [3000000., 2900000.])
+        # Row 40 holds the curves at 20C, the last row at 150C
+        self.assertEqual(table[80:82], [2998200., 2898560.])
+        self.assertEqual(table[600:602], [2996250., 2897000.])
+    def test_linear_curves(self):
+        drift = self.make_table(LINEAR_CURVES, LINEAR_MIN_FREQ)
+        freqs = [2946400., 2821000., 3000000., 2795000., 2700000.]
+        expected = [
+            2948200.,       # halfway between the top curves
+            2822294.354839, # between the lower curves
+            3002000.,       # above the top curve (shifted with it)
+            2795000.,       # below the lowest curve
+            2700000.,       # below min_freq
+        ]
+        out = self.calc_freqs(drift, freqs, 40., 20.)
+        for freq, exp in zip(out, expected):
+            self.assertAlmostEqual(freq, exp, places=5)
+        # The reverse conversion returns the original frequencies
+        out = self.calc_freqs(drift, expected[:3], 20., 40.)
+        for freq, exp in zip(out, freqs[:3]):
+            self.assertAlmostEqual(freq, exp, places=5)
+    def test_extrapolation(self):
+        # Beyond the table the curves are extended linearly
+        drift = self.make_table(LINEAR_CURVES, LINEAR_MIN_FREQ)
+        out = self.calc_freqs(drift, [2935600.], 160., 20.)
+        self.assertAlmostEqual(out[0], 2948200., places=5)
+    def test_quadratic_curves(self):
+        # Between table rows the curves are interpolated linearly.  For
+        # a curve c*T^2 the error is at most c/4 times the step squared
+        # (.03125Hz here).
+        curves = [Polynomial2d(3000000., -100., .5),
+                  Polynomial2d(2900000., -80., .4)]
+        drift = self.make_table(curves, 2800000.)
+        out = self.calc_freqs(drift, [curves[0](40.25)], 40.25, 20.)
+        self.assertAlmostEqual(out[0], curves[0](20.), delta=.032)
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,39 @@
+# Tests for the load cell contact point fit
+#
+# Copyright (C) 2026  pulponair <pulponair@users.noreply.github.com>
+#
+# This file may be distributed under the terms of the GNU GPLv3 license.
+import sys, os, math, unittest
+sys.path.append(os.path.join(os.path.dirname(os.path.realpath(__file__)),
+                             '..', '..', 'klippy'))
+from extras import load_cell
+
+# Force versus height samples that are flat above contact_z and rise
+# linearly below it (with a little noise)
+def knee_points(contact_z, count=60):
+    points = []
+    for i in range(count):
+        z = .400 - i * .005
+        force = 150. + 5. * math.sin(i * 1.7)
+        if z < contact_z:
+            force += 20000. * (contact_z - z)
+        points.append((z, force))
+    return points
+
+class TestFitContactPoint(unittest.TestCase):
+    def test_knee(self):
+        for contact_z in [.1234, .2000, .3111]:
+            fit_z = load_cell.fit_contact_point(knee_points(contact_z))
+            self.assertIsNotNone(fit_z)
+            self.assertAlmostEqual(fit_z, contact_z, delta=.0005)
+    def test_no_knee(self):
+        # A curve without a knee must not report a contact point
+        points = [(z, 150. + 20000. * (.500 - z))
+                  for z, force in knee_points(.1234)]
+        self.assertIsNone(load_cell.fit_contact_point(points))
+    def test_too_few_heights(self):
+        points = knee_points(.3900, count=5)
+        self.assertIsNone(load_cell.fit_contact_point(points))
+
+if __name__ == '__main__':
+    unittest.main()